@@ -21,70 +21,49 @@ int main(int argc, char *argv[])
   //kohn3d.set_loop_count(Kohn3D::LOOP_INFINITE);
   kohn3d.init_end();
 
-  Kohn3D::Triangle triangles[12];
+  // The 8 corners are shared by the 12 triangles that make the 6 sides.
+  // Every triangle winds the same way looking at the cube from outside
+  // so the faces pointing away can be culled.
+  Mesh cube;
+
+  cube.add_vertex(-50, -50,  50);
+  cube.add_vertex( 50, -50,  50);
+  cube.add_vertex(-50,  50,  50);
+  cube.add_vertex( 50,  50,  50);
+  cube.add_vertex(-50, -50, -50);
+  cube.add_vertex( 50, -50, -50);
+  cube.add_vertex(-50,  50, -50);
+  cube.add_vertex( 50,  50, -50);
 
   // Blue.
-  triangles[0].x0 = -50; triangles[1].x0 =  50;
-  triangles[0].y0 = -50; triangles[1].y0 =  50;
-  triangles[0].z0 =  50; triangles[1].z0 =  50;
-  triangles[0].x1 = -50; triangles[1].x1 =  50;
-  triangles[0].y1 =  50; triangles[1].y1 = -50;
-  triangles[0].z1 =  50; triangles[1].z1 =  50;
-  triangles[0].x2 =  50; triangles[1].x2 = -50;
-  triangles[0].y2 = -50; triangles[1].y2 =  50;
-  triangles[0].z2 =  50; triangles[1].z2 =  50;
+  cube.add_triangle(0, 1, 2);
+  cube.add_triangle(3, 2, 1);
 
   // Green.
-  triangles[2] = triangles[0];
-  triangles[2].z0 = -50;
-  triangles[2].z1 = -50;
-  triangles[2].z2 = -50;
-  triangles[3] = triangles[1];
-  triangles[3].z0 = -50;
-  triangles[3].z1 = -50;
-  triangles[3].z2 = -50;
+  cube.add_triangle(4, 6, 5);
+  cube.add_triangle(7, 5, 6);
 
   // Red.
-  triangles[4].x0 =  50; triangles[5].x0 =  50;
-  triangles[4].y0 = -50; triangles[5].y0 =  50;
-  triangles[4].z0 = -50; triangles[5].z0 =  50;
-  triangles[4].x1 =  50; triangles[5].x1 =  50;
-  triangles[4].y1 =  50; triangles[5].y1 = -50;
-  triangles[4].z1 = -50; triangles[5].z1 =  50;
-  triangles[4].x2 =  50; triangles[5].x2 =  50;
-  triangles[4].y2 = -50; triangles[5].y2 =  50;
-  triangles[4].z2 =  50; triangles[5].z2 = -50;
+  cube.add_triangle(5, 7, 1);
+  cube.add_triangle(3, 1, 7);
 
   // Purple.
-  triangles[6] = triangles[4];
-  triangles[6].x0 = -50;
-  triangles[6].x1 = -50;
-  triangles[6].x2 = -50;
-  triangles[7] = triangles[5];
-  triangles[7].x0 = -50;
-  triangles[7].x1 = -50;
-  triangles[7].x2 = -50;
+  cube.add_triangle(4, 0, 6);
+  cube.add_triangle(2, 6, 0);
 
   // Cyan.
-  triangles[8].x0 = -50; triangles[9].x0 =  50;
-  triangles[8].y0 =  50; triangles[9].y0 =  50;
-  triangles[8].z0 = -50; triangles[9].z0 =  50;
-  triangles[8].x1 = -50; triangles[9].x1 =  50;
-  triangles[8].y1 =  50; triangles[9].y1 =  50;
-  triangles[8].z1 =  50; triangles[9].z1 = -50;
-  triangles[8].x2 =  50; triangles[9].x2 = -50;
-  triangles[8].y2 =  50; triangles[9].y2 =  50;
-  triangles[8].z2 = -50; triangles[9].z2 =  50;
+  cube.add_triangle(6, 2, 7);
+  cube.add_triangle(3, 7, 2);
 
   // Yellow.
-  triangles[10] = triangles[8];
-  triangles[10].y0 = -50;
-  triangles[10].y1 = -50;
-  triangles[10].y2 = -50;
-  triangles[11] = triangles[9];
-  triangles[11].y0 = -50;
-  triangles[11].y1 = -50;
-  triangles[11].y2 = -50;
+  cube.add_triangle(4, 5, 0);
+  cube.add_triangle(1, 0, 5);
+
+  uint32_t colors[12];
+
+  for (int n = 0; n < 12; n++) { colors[n] = (n / 2) + 1; }
+
+  kohn3d.set_cull_mode(Rasterizer::CULL_COUNTER_CLOCKWISE);
 
   Kohn3D::Rotation rotation;
 
@@ -96,10 +75,7 @@ int main(int argc, char *argv[])
 
     kohn3d.clear();
 
-    for (int n = 0; n < 12; n++)
-    {
-      kohn3d.draw_triangle(triangles[n], rotation, 160, 120, 0, (n / 2) + 1);
-    }
+    kohn3d.draw_mesh(cube, rotation, 160, 120, 0, colors);
 
     kohn3d.write_frame();
 break;
@@ -28,6 +28,12 @@ int main(int argc, char *argv[])
     exit(1);
   }
 
+  // The background starts out very small, which is cheaper to shrink
+  // with a summed area table. Hello is drawn at many sizes, mipmaps
+  // keep it from shimmering as it shrinks.
+  picture_background.enable_summed_area_table(true);
+  picture_hello.enable_mipmaps(true);
+
   //float bg_r = 0;
   //int alpha = 0xff;
   //int alpha_dx = -5;
@@ -0,0 +1,173 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "FastMath.h"
+
+#ifdef __SSE2__
+// Same as round_to_int() for 2 values: truncate after adding +/- 0.5.
+static __m128i round_to_int_pd(__m128d value)
+{
+  const __m128d sign = _mm_and_pd(value, _mm_set1_pd(-0.0));
+
+  return _mm_cvttpd_epi32(_mm_add_pd(value, _mm_or_pd(_mm_set1_pd(0.5), sign)));
+}
+
+// Sets both halves of each 64 bit lane where (k & bit) != 0.
+static __m128d get_mask(__m128i k, int bit)
+{
+  __m128i b = _mm_and_si128(_mm_unpacklo_epi32(k, k), _mm_set1_epi32(bit));
+
+  return _mm_castsi128_pd(_mm_cmpeq_epi32(b, _mm_set1_epi32(bit)));
+}
+
+static __m128d select(__m128d mask, __m128d a, __m128d b)
+{
+  return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b));
+}
+#endif
+
+void FastMath::from_xy(double *p, int *r, const int *x, const int *y, int count)
+{
+  int n = 0;
+
+#ifdef __SSE2__
+  const __m128d zero = _mm_setzero_pd();
+  const __m128d one = _mm_set1_pd(1.0);
+  const __m128d abs_mask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+  const __m128d pi = _mm_set1_pd(M_PI);
+
+  for (; n + 2 <= count; n += 2)
+  {
+    __m128d vx = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i *)(x + n)));
+    __m128d vy = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i *)(y + n)));
+
+    __m128d length = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(vx, vx), _mm_mul_pd(vy, vy)));
+    _mm_storel_epi64((__m128i *)(r + n), _mm_cvttpd_epi32(length));
+
+    __m128d ax = _mm_and_pd(vx, abs_mask);
+    __m128d ay = _mm_and_pd(vy, abs_mask);
+    __m128d is_swapped = _mm_cmpgt_pd(ay, ax);
+    __m128d hi = _mm_max_pd(ax, ay);
+    __m128d lo = _mm_min_pd(ax, ay);
+    __m128d is_zero = _mm_cmpeq_pd(hi, zero);
+    __m128d t = _mm_andnot_pd(is_zero, _mm_div_pd(lo, select(is_zero, one, hi)));
+
+    __m128d is_high = _mm_cmpge_pd(t, _mm_set1_pd(TAN_3PI_16));
+    __m128d is_middle = _mm_andnot_pd(is_high, _mm_cmpge_pd(t, _mm_set1_pd(TAN_PI_16)));
+
+    __m128d a = _mm_or_pd(
+      _mm_and_pd(is_high, _mm_set1_pd(M_PI / 4)),
+      _mm_and_pd(is_middle, _mm_set1_pd(M_PI / 8)));
+    __m128d tan_a = _mm_or_pd(
+      _mm_and_pd(is_high, one),
+      _mm_and_pd(is_middle, _mm_set1_pd(TAN_PI_8)));
+
+    t = _mm_div_pd(_mm_sub_pd(t, tan_a), _mm_add_pd(one, _mm_mul_pd(t, tan_a)));
+
+    __m128d t2 = _mm_mul_pd(t, t);
+    __m128d poly = _mm_add_pd(_mm_set1_pd(A11), _mm_mul_pd(t2, _mm_set1_pd(A13)));
+    poly = _mm_add_pd(_mm_set1_pd(A9), _mm_mul_pd(t2, poly));
+    poly = _mm_add_pd(_mm_set1_pd(A7), _mm_mul_pd(t2, poly));
+    poly = _mm_add_pd(_mm_set1_pd(A5), _mm_mul_pd(t2, poly));
+    poly = _mm_add_pd(_mm_set1_pd(A3), _mm_mul_pd(t2, poly));
+
+    __m128d angle = _mm_add_pd(_mm_add_pd(a, t), _mm_mul_pd(_mm_mul_pd(t, t2), poly));
+
+    angle = select(is_swapped, _mm_sub_pd(_mm_set1_pd(M_PI / 2), angle), angle);
+    angle = select(_mm_cmplt_pd(vx, zero), _mm_sub_pd(pi, angle), angle);
+    angle = _mm_xor_pd(angle, _mm_and_pd(_mm_cmplt_pd(vy, zero), _mm_set1_pd(-0.0)));
+
+    // Same as PolarCoords::adjust_if_negative().
+    angle = select(
+      _mm_cmplt_pd(angle, zero),
+      _mm_add_pd(angle, _mm_set1_pd(M_PI * 2)),
+      angle);
+
+    _mm_storeu_pd(p + n, angle);
+  }
+#endif
+
+  for (; n < count; n++)
+  {
+    r[n] = (int)sqrt(((double)x[n] * x[n]) + ((double)y[n] * y[n]));
+    p[n] = atan2(y[n], x[n]);
+
+    if (p[n] < 0) { p[n] += M_PI * 2; }
+  }
+}
+
+void FastMath::to_xy(int *x, int *y, const double *p, const int *r, int count)
+{
+  int n = 0;
+
+#ifdef __SSE2__
+  for (; n + 2 <= count; n += 2)
+  {
+    __m128d vp = _mm_loadu_pd(p + n);
+    __m128d vr = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i *)(r + n)));
+
+    __m128i k = round_to_int_pd(_mm_mul_pd(vp, _mm_set1_pd(TWO_OVER_PI)));
+    __m128d dk = _mm_cvtepi32_pd(k);
+
+    __m128d t = _mm_sub_pd(
+      _mm_sub_pd(vp, _mm_mul_pd(dk, _mm_set1_pd(PI_2_HI))),
+      _mm_mul_pd(dk, _mm_set1_pd(PI_2_LO)));
+    __m128d t2 = _mm_mul_pd(t, t);
+
+    __m128d ps = _mm_add_pd(_mm_set1_pd(S9), _mm_mul_pd(t2, _mm_set1_pd(S11)));
+    ps = _mm_add_pd(_mm_set1_pd(S7), _mm_mul_pd(t2, ps));
+    ps = _mm_add_pd(_mm_set1_pd(S5), _mm_mul_pd(t2, ps));
+    ps = _mm_add_pd(_mm_set1_pd(S3), _mm_mul_pd(t2, ps));
+    ps = _mm_add_pd(t, _mm_mul_pd(_mm_mul_pd(t, t2), ps));
+
+    __m128d pc = _mm_add_pd(_mm_set1_pd(C10), _mm_mul_pd(t2, _mm_set1_pd(C12)));
+    pc = _mm_add_pd(_mm_set1_pd(C8), _mm_mul_pd(t2, pc));
+    pc = _mm_add_pd(_mm_set1_pd(C6), _mm_mul_pd(t2, pc));
+    pc = _mm_add_pd(_mm_set1_pd(C4), _mm_mul_pd(t2, pc));
+    pc = _mm_add_pd(_mm_set1_pd(C2), _mm_mul_pd(t2, pc));
+    pc = _mm_add_pd(_mm_set1_pd(1.0), _mm_mul_pd(t2, pc));
+
+    // Quadrants 1 and 3 swap sin and cos. Sin is negative in quadrants 2
+    // and 3, cos in quadrants 1 and 2.
+    const __m128d sign = _mm_set1_pd(-0.0);
+    __m128d is_odd = get_mask(k, 1);
+    __m128d is_upper = get_mask(k, 2);
+
+    __m128d s = select(is_odd, pc, ps);
+    __m128d c = select(is_odd, ps, pc);
+
+    s = _mm_xor_pd(s, _mm_and_pd(is_upper, sign));
+    c = _mm_xor_pd(c, _mm_and_pd(_mm_xor_pd(is_odd, is_upper), sign));
+
+    _mm_storel_epi64((__m128i *)(x + n), round_to_int_pd(_mm_mul_pd(vr, c)));
+    _mm_storel_epi64((__m128i *)(y + n), round_to_int_pd(_mm_mul_pd(vr, s)));
+  }
+#endif
+
+  for (; n < count; n++)
+  {
+    double s, c;
+
+    sin_cos(p[n], s, c);
+
+    x[n] = round_to_int(r[n] * c);
+    y[n] = round_to_int(r[n] * s);
+  }
+}
+
@@ -0,0 +1,133 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+#include <stdint.h>
+#include <math.h>
+
+// Polynomial versions of the trig functions used by the polar code that
+// inline and avoid the libm calls. Accuracy compared to libm:
+//
+//   sin(), cos()  within 1e-10 for |p| < 1e6 (the argument is reduced to
+//                 [-pi/4, pi/4] and loses precision above that).
+//   atan2()       within 1e-10 radians everywhere.
+//
+// That is far below what matters once a result is rounded to a pixel.
+// The batch functions give exactly the same results as the scalar ones.
+class FastMath
+{
+public:
+  static int round_to_int(double value)
+  {
+    return (int)(value + (value < 0 ? -0.5 : 0.5));
+  }
+
+  static void sin_cos(double p, double &s, double &c)
+  {
+    // p = (k * pi / 2) + t, with t in [-pi/4, pi/4]. pi / 2 is split in
+    // two so k * PI_2_HI is exact.
+    int k = round_to_int(p * TWO_OVER_PI);
+    double t = (p - (k * PI_2_HI)) - (k * PI_2_LO);
+    double t2 = t * t;
+
+    double ps = t + (t * t2 * (S3 + t2 * (S5 + t2 * (S7 + t2 * (S9 + t2 * S11)))));
+    double pc = 1.0 + (t2 * (C2 + t2 * (C4 + t2 * (C6 + t2 * (C8 + t2 * (C10 + t2 * C12))))));
+
+    switch (k & 3)
+    {
+      case 0:  s =  ps; c =  pc; break;
+      case 1:  s =  pc; c = -ps; break;
+      case 2:  s = -ps; c = -pc; break;
+      default: s = -pc; c =  ps; break;
+    }
+  }
+
+  static double sin(double p)
+  {
+    double s, c;
+    sin_cos(p, s, c);
+    return s;
+  }
+
+  static double cos(double p)
+  {
+    double s, c;
+    sin_cos(p, s, c);
+    return c;
+  }
+
+  static double atan2(double y, double x)
+  {
+    double ax = fabs(x);
+    double ay = fabs(y);
+    double hi = ax > ay ? ax : ay;
+    double lo = ax > ay ? ay : ax;
+    double t = hi == 0 ? 0 : lo / hi;
+
+    // atan(t) = a + atan((t - tan(a)) / (1 + t * tan(a))). Picking a as a
+    // multiple of pi / 8 leaves |t| <= tan(pi / 16) for the polynomial.
+    double a = 0.0, tan_a = 0.0;
+
+    if (t >= TAN_3PI_16) { a = M_PI / 4; tan_a = 1.0; }
+      else
+    if (t >= TAN_PI_16) { a = M_PI / 8; tan_a = TAN_PI_8; }
+
+    t = (t - tan_a) / (1.0 + (t * tan_a));
+
+    double t2 = t * t;
+    double r = a + t + (t * t2 * (A3 + t2 * (A5 + t2 * (A7 + t2 * (A9 + t2 * (A11 + t2 * A13))))));
+
+    if (ay > ax) { r = (M_PI / 2) - r; }
+    if (x < 0) { r = M_PI - r; }
+    if (y < 0) { r = -r; }
+
+    return r;
+  }
+
+  // Batch versions of PolarCoords::from_xy() / to_xy() with FastMath,
+  // done 2 at a time with SSE2.
+  static void from_xy(double *p, int *r, const int *x, const int *y, int count);
+  static void to_xy(int *x, int *y, const double *p, const int *r, int count);
+
+private:
+  static constexpr double TWO_OVER_PI = 2.0 / M_PI;
+  static constexpr double PI_2_HI = 1.57079632673412561417e+00;
+  static constexpr double PI_2_LO = 6.07710050650619224932e-11;
+
+  static constexpr double S3  = -1.0 / 6.0;
+  static constexpr double S5  =  1.0 / 120.0;
+  static constexpr double S7  = -1.0 / 5040.0;
+  static constexpr double S9  =  1.0 / 362880.0;
+  static constexpr double S11 = -1.0 / 39916800.0;
+
+  static constexpr double C2  = -1.0 / 2.0;
+  static constexpr double C4  =  1.0 / 24.0;
+  static constexpr double C6  = -1.0 / 720.0;
+  static constexpr double C8  =  1.0 / 40320.0;
+  static constexpr double C10 = -1.0 / 3628800.0;
+  static constexpr double C12 =  1.0 / 479001600.0;
+
+  static constexpr double TAN_PI_16  = 0.19891236737965800691;
+  static constexpr double TAN_PI_8   = 0.41421356237309504880;
+  static constexpr double TAN_3PI_16 = 0.66817863791929891999;
+
+  static constexpr double A3  = -1.0 / 3.0;
+  static constexpr double A5  =  1.0 / 5.0;
+  static constexpr double A7  = -1.0 / 7.0;
+  static constexpr double A9  =  1.0 / 9.0;
+  static constexpr double A11 = -1.0 / 11.0;
+  static constexpr double A13 =  1.0 / 13.0;
+};
+
+#endif
+
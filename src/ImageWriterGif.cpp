@@ -16,7 +16,14 @@
 #include "ImageWriterGif.h"
 
 ImageWriterGif::ImageWriterGif(int width, int height) :
-  ImageWriter(width, height)
+  ImageWriter(width, height),
+  queued_count { 0 },
+  encode_threads { 1 },
+  encode_queue_depth { 0 },
+  encode_strips { 1 },
+  worker_pool { nullptr },
+  do_delta_frames { false },
+  do_delta_transparency { false }
 {
   memset(&gif_header, 0, sizeof(gif_header));
   memcpy(gif_header.version, "GIF89a", 6);
@@ -28,12 +35,16 @@ ImageWriterGif::ImageWriterGif(int width, int height) :
 ImageWriterGif::~ImageWriterGif()
 {
   finish();
+
+  delete worker_pool;
 }
 
 void ImageWriterGif::finish()
 {
   if (fp != nullptr)
   {
+    flush_frames();
+
     // End Marker.
     putc(';', fp);
   }
@@ -43,7 +54,8 @@ int ImageWriterGif::create_headers()
 {
   uint8_t fields;
 
-  fwrite(gif_header.version, 1, 6, fp);
+  buffer.clear();
+  buffer.insert(buffer.end(), gif_header.version, gif_header.version + 6);
 
   // Compute bits per pixel and max colors for that.
   int bits_per_pixel = compute_bits_per_pixel(max_colors);
@@ -51,138 +63,337 @@ int ImageWriterGif::create_headers()
   max_colors = 1 << bits_per_pixel;
 
   // Copy GifHeader (Logical Screen Descriptor) to memory.
-  write_uint16(gif_header.width);
-  write_uint16(gif_header.height);
+  put_uint16(buffer, gif_header.width);
+  put_uint16(buffer, gif_header.height);
   fields = 0x80 | ((color_resolution - 1) << 4) | (bits_per_pixel - 1);
-  putc(fields, fp);
-  putc(bg_color_index, fp);
-  putc(0, fp);
+  buffer.push_back(fields);
+  buffer.push_back(bg_color_index);
+  buffer.push_back(0);
 
   // Global Color Map (palettes).
   for (int i = 0; i < max_colors; i++)
   {
-    putc((palette[i] >> 16) & 0xff, fp);
-    putc((palette[i] >> 8) & 0xff, fp);
-    putc(palette[i] & 0xff, fp);
+    buffer.push_back((palette[i] >> 16) & 0xff);
+    buffer.push_back((palette[i] >> 8) & 0xff);
+    buffer.push_back(palette[i] & 0xff);
   }
 
   if (loop_count != -1)
   {
     // Application Extension Block for NETSCAPE (for looping GIFs).
-    putc(0x21, fp);
-    putc(0xff, fp);
-    putc(0x0b, fp);
-    fwrite("NETSCAPE", 1, 8, fp);
-    fwrite("2.0", 1, 3, fp);
-    putc(0x03, fp);
-    putc(0x01, fp);
-    write_uint16(loop_count);
-    putc(0x00, fp);
+    const char *netscape = "NETSCAPE2.0";
+
+    buffer.push_back(0x21);
+    buffer.push_back(0xff);
+    buffer.push_back(0x0b);
+    buffer.insert(buffer.end(), netscape, netscape + 11);
+    buffer.push_back(0x03);
+    buffer.push_back(0x01);
+    put_uint16(buffer, loop_count);
+    buffer.push_back(0x00);
   }
 
+  fwrite(buffer.data(), 1, buffer.size(), fp);
+
   return 0;
 }
 
 int ImageWriterGif::add_frame(uint8_t *image, uint32_t *color_table)
 {
-  int ptr = 0, i;
+  if (encoders.empty())
+  {
+    if (encode_threads > 1)
+    {
+      worker_pool = new WorkerPool(encode_threads);
+      encoders.resize(encode_queue_depth > 0 ? encode_queue_depth : encode_threads);
+    }
+      else
+    {
+      encoders.resize(1);
+    }
+  }
+
+  Encoder &encoder = encoders[queued_count++];
 
   int bits_per_pixel = compute_bits_per_pixel(max_colors);
   int code_size = bits_per_pixel;
-  int clear_code = max_colors;
-  int eof_code = max_colors + 1;
+
+  // Area of the canvas this frame covers.
+  int x0 = 0;
+  int y0 = 0;
+  int x1 = gif_header.width - 1;
+  int y1 = gif_header.height - 1;
+  int disposal_method = 0;
+  bool is_transparent = do_transparency;
+  int transparent_index = transparent_color_index;
+
+  const int length = gif_header.width * gif_header.height;
+
+  encoder.pixels = image;
+
+  if (do_delta_frames && !do_transparency)
+  {
+    // Leave each frame in place so the next one only has to cover what
+    // changed.
+    disposal_method = 1;
+
+    if (!previous.empty())
+    {
+      get_changed_area(image, x0, y0, x1, y1);
+
+      const int area_width = x1 - x0 + 1;
+      const int area_height = y1 - y0 + 1;
+
+      encoder.storage.resize(area_width * area_height);
+
+      for (int y = 0; y < area_height; y++)
+      {
+        memcpy(
+          encoder.storage.data() + (y * area_width),
+          image + ((y0 + y) * gif_header.width) + x0,
+          area_width);
+      }
+
+      if (do_delta_transparency)
+      {
+        transparent_index =
+          get_unused_color(encoder.storage.data(), encoder.storage.size());
+
+        if (transparent_index != -1)
+        {
+          is_transparent = true;
+
+          for (int y = 0; y < area_height; y++)
+          {
+            const int offset = ((y0 + y) * gif_header.width) + x0;
+            uint8_t *row = encoder.storage.data() + (y * area_width);
+
+            for (int x = 0; x < area_width; x++)
+            {
+              if (image[offset + x] == previous[offset + x])
+              {
+                row[x] = transparent_index;
+              }
+            }
+          }
+        }
+      }
+
+      encoder.pixels = encoder.storage.data();
+    }
+
+    previous.assign(image, image + length);
+  }
+
+  // Queued frames need their own copy since the caller reuses image.
+  if (worker_pool != nullptr && encoder.pixels == image)
+  {
+    encoder.storage.assign(image, image + length);
+    encoder.pixels = encoder.storage.data();
+  }
+
+  encoder.width = x1 - x0 + 1;
+  encoder.height = y1 - y0 + 1;
+
+  std::vector<uint8_t> &buffer = encoder.buffer;
+
+  buffer.clear();
 
   // Graphics Control Extension Block (GIF89a only).
   int user_input_flag = 0;
-  int disposal_method = 0;
 
-  putc(0x21, fp);
-  putc(0xf9, fp);
-  putc(0x04, fp);
-  putc((disposal_method << 2) | (user_input_flag << 1) | do_transparency, fp);
-  write_uint16(delay);
-  putc(transparent_color_index, fp);
-  putc(0, fp);
+  buffer.push_back(0x21);
+  buffer.push_back(0xf9);
+  buffer.push_back(0x04);
+  buffer.push_back((disposal_method << 2) | (user_input_flag << 1) | is_transparent);
+  put_uint16(buffer, delay);
+  buffer.push_back(is_transparent ? transparent_index : transparent_color_index);
+  buffer.push_back(0);
 
   // Image Descriptor Block.
-  putc(',', fp);
-  write_uint16(0);
-  write_uint16(0);
-  write_uint16(gif_header.width);
-  write_uint16(gif_header.height);
-  putc(bits_per_pixel - 1, fp);
+  buffer.push_back(',');
+  put_uint16(buffer, x0);
+  put_uint16(buffer, y0);
+  put_uint16(buffer, x1 - x0 + 1);
+  put_uint16(buffer, y1 - y0 + 1);
+  buffer.push_back(bits_per_pixel - 1);
+
+  buffer.push_back(code_size);
+
+  if (queued_count == (int)encoders.size()) { flush_frames(); }
+
+  return 0;
+}
+
+void ImageWriterGif::encode(Encoder &encoder)
+{
+  const int code_size = compute_bits_per_pixel(max_colors);
+
+  split_strips(encoder);
+
+  for (Strip &strip : encoder.strips)
+  {
+    compress(strip, code_size, encoder.strips.size() == 1);
+  }
+
+  finish_frame(encoder);
+}
+
+void ImageWriterGif::split_strips(Encoder &encoder)
+{
+  const int count = encode_strips < encoder.height ? encode_strips : encoder.height;
 
+  encoder.strips.resize(count > 1 ? count : 1);
 
-  putc(code_size, fp);
+  for (int n = 0; n < (int)encoder.strips.size(); n++)
+  {
+    const int y0 = (n * encoder.height) / encoder.strips.size();
+    const int y1 = ((n + 1) * encoder.height) / encoder.strips.size();
 
-  // Setup LZW tree.
-  CompressNode node[4097];
+    encoder.strips[n].pixels = encoder.pixels + (y0 * encoder.width);
+    encoder.strips[n].length = (y1 - y0) * encoder.width;
+  }
+}
+
+void ImageWriterGif::finish_frame(Encoder &encoder)
+{
+  const uint8_t *codes = encoder.strips[0].codes.data();
+  int size = (encoder.strips[0].bit_count + 7) / 8;
 
-  for (i = 0; i < max_colors; i++)
+  if (encoder.strips.size() > 1)
   {
-    node[i].color = i;
-    node[i].right = i + 1;
-    node[i].down = -1;
+    // Each strip was compressed as if right after a clear code. The
+    // clear code goes in as wide as the code after the last one of the
+    // strip before it, which is what the decoder will be expecting.
+    const int code_size = compute_bits_per_pixel(max_colors);
+    const int clear_code = max_colors;
+    const int eof_code = max_colors + 1;
+    int total = 16;
+
+    for (const Strip &strip : encoder.strips) { total += (strip.bit_count / 8) + 4; }
+
+    encoder.codes.resize(total);
+
+    BitStream bit_stream(encoder.codes.data());
+    int clear_code_size = code_size + 1;
+
+    for (const Strip &strip : encoder.strips)
+    {
+      bit_stream.append(clear_code, clear_code_size);
+      bit_stream.append_bits(strip.codes.data(), strip.bit_count);
+
+      clear_code_size = strip.end_code_size;
+    }
+
+    bit_stream.append(eof_code, clear_code_size);
+
+    codes = encoder.codes.data();
+    size = bit_stream.finish();
   }
 
-  // Compressed data blocks follow.
+  // Compressed data blocks follow, each up to 255 bytes after a length
+  // byte, then an empty block.
+  for (int n = 0; n < size; n += 255)
+  {
+    const int block_size = size - n < 255 ? size - n : 255;
+
+    encoder.buffer.push_back(block_size);
+    encoder.buffer.insert(
+      encoder.buffer.end(),
+      codes + n,
+      codes + n + block_size);
+  }
+
+  encoder.buffer.push_back(0);
+}
+
+void ImageWriterGif::flush_frames()
+{
+  if (queued_count == 0) { return; }
+
+  if (worker_pool == nullptr)
+  {
+    encode(encoders[0]);
+  }
+    else
+  if (queued_count == 1 && encode_strips > 1)
+  {
+    // A frame on its own can only be spread across threads by strips.
+    Encoder &encoder = encoders[0];
+    const int code_size = compute_bits_per_pixel(max_colors);
+
+    split_strips(encoder);
+
+    worker_pool->run(
+      encoder.strips.size(),
+      [&](int index)
+      {
+        compress(encoder.strips[index], code_size, encoder.strips.size() == 1);
+      });
+
+    finish_frame(encoder);
+  }
+    else
+  {
+    worker_pool->run(queued_count, [this](int index) { encode(encoders[index]); });
+  }
+
+  for (int n = 0; n < queued_count; n++)
+  {
+    fwrite(encoders[n].buffer.data(), 1, encoders[n].buffer.size(), fp);
+  }
+
+  queued_count = 0;
+}
+
+void ImageWriterGif::compress(Strip &strip, int code_size, bool is_whole)
+{
+  const uint8_t *image = strip.pixels;
+  const int length = strip.length;
+  LzwDictionary &dictionary = strip.dictionary;
+
+  int clear_code = max_colors;
+  int eof_code = max_colors + 1;
   int table_start_size = max_colors + 2;
   int next_code = table_start_size;
   int curr_code_size = code_size + 1;
   int curr_code = -1;
-  int data_size = 0;
 
-  // LZW Compression.
-  BitStream bit_stream;
+  int image_ptr = 0;
+
+  // LZW Compression. Every pixel adds at most one code of up to 12 bits,
+  // plus a clear code each time the table fills.
+  strip.codes.resize((length * 2) + 16);
 
-  bit_stream.append(clear_code, curr_code_size);
+  BitStream bit_stream(strip.codes.data());
 
-  int image_ptr = 0;
-  int length = gif_header.width * gif_header.height;
-  uint8_t color = image[image_ptr++];
-  int block_ptr;
-  uint8_t data[1024];
+  // A strip's clear code is added when the strips are joined.
+  if (is_whole) { bit_stream.append(clear_code, curr_code_size); }
 
-  block_ptr = ptr;
-  data[ptr++] = 0;
+  dictionary.clear();
+
+  uint8_t color = image[image_ptr++];
 
   curr_code = color;
-  int last_code = curr_code;
 
   while (image_ptr < length)
   {
-    color = image[image_ptr++];
+    // The string for curr_code always ends with the previous pixel.
+    const bool is_repeat = image[image_ptr] == color;
 
-    if (node[curr_code].down == -1)
-    {
-      last_code = curr_code;
-      node[curr_code].down = next_code;
-    }
-      else
-    {
-      last_code = curr_code;
-      curr_code = node[curr_code].down;
+    color = image[image_ptr++];
 
-      while (node[curr_code].color != color && node[curr_code].right != -1)
-      {
-        curr_code=node[curr_code].right;
-      }
+    int code = dictionary.find(curr_code, color, is_repeat);
 
-      if (node[curr_code].color != color && node[curr_code].right == -1)
-      {
-        node[curr_code].right=next_code;
-      }
-        else
-      {
-        continue;
-      }
+    if (code != -1)
+    {
+      curr_code = code;
+      continue;
     }
 
-    bit_stream.append(last_code, curr_code_size);
+    bit_stream.append(curr_code, curr_code_size);
 
-    node[next_code].right = -1;
-    node[next_code].down = -1;
-    node[next_code].color = color;
+    dictionary.add(curr_code, color, is_repeat, next_code);
     curr_code = color;
 
     if ((next_code >> curr_code_size) != 0)
@@ -191,10 +402,7 @@ int ImageWriterGif::add_frame(uint8_t *image, uint32_t *color_table)
       {
         bit_stream.append(clear_code, curr_code_size);
 
-        for (i = 0; i < max_colors; i++)
-        {
-          node[i].down = -1;
-        }
+        dictionary.clear();
 
         next_code = table_start_size - 1;
         curr_code_size = code_size;
@@ -204,54 +412,86 @@ int ImageWriterGif::add_frame(uint8_t *image, uint32_t *color_table)
     }
 
     next_code++;
+  }
 
-    while (bit_stream.size() >= 8)
-    {
-      data[ptr++] = bit_stream.get_byte();
-      data_size++;
-
-      if (data_size >= 255)
-      {
-        data[block_ptr] = data_size;
-        data_size = 0;
-        fwrite(data, 1, ptr, fp);
+  bit_stream.append(curr_code, curr_code_size);
 
-        ptr = 0;
-        block_ptr = ptr;
-        data[ptr++] = 0;
-      }
-    }
+  // The decoder adds one more code after reading the last one, so the
+  // code after it can be a bit wider.
+  if ((next_code >> curr_code_size) != 0 && curr_code_size < 12)
+  {
+    curr_code_size++;
   }
 
-  bit_stream.append(curr_code, curr_code_size);
-  bit_stream.append(eof_code, curr_code_size);
+  if (is_whole) { bit_stream.append(eof_code, curr_code_size); }
+
+  strip.bit_count = bit_stream.get_bit_count();
+  strip.end_code_size = curr_code_size;
+
+  bit_stream.finish();
+}
+
+void ImageWriterGif::get_changed_area(
+  const uint8_t *image,
+  int &x0,
+  int &y0,
+  int &x1,
+  int &y1)
+{
+  const int width = gif_header.width;
+  const int height = gif_header.height;
+
+  y0 = 0;
+  y1 = height - 1;
 
-  while (bit_stream.size() > 0)
+  while (y0 <= y1 && memcmp(image + (y0 * width), &previous[y0 * width], width) == 0)
   {
-    data[ptr++] = bit_stream.get_byte();
-    data_size++;
+    y0++;
+  }
 
-    if (data_size >= 255)
-    {
-      data[block_ptr] = data_size;
-      data_size = 0;
-      fwrite(data, 1, ptr, fp);
+  // Nothing changed, but a frame still has to go out for its delay.
+  if (y0 > y1)
+  {
+    x0 = x1 = y0 = y1 = 0;
+    return;
+  }
 
-      ptr = 0;
-      block_ptr = ptr;
-      data[ptr++] = 0;
-    }
+  while (memcmp(image + (y1 * width), &previous[y1 * width], width) == 0)
+  {
+    y1--;
   }
 
-  if (data_size > 0)
+  x0 = width - 1;
+  x1 = 0;
+
+  for (int y = y0; y <= y1; y++)
   {
-    data[block_ptr] = data_size;
-    fwrite(data, 1, data_size + 1, fp);
+    const uint8_t *row = image + (y * width);
+    const uint8_t *old_row = &previous[y * width];
+
+    int left = 0;
+    int right = width - 1;
+
+    while (left < x0 && row[left] == old_row[left]) { left++; }
+    while (right > x1 && row[right] == old_row[right]) { right--; }
+
+    if (left < x0) { x0 = left; }
+    if (right > x1) { x1 = right; }
   }
+}
 
-  putc(0, fp);
+int ImageWriterGif::get_unused_color(const uint8_t *pixels, int length)
+{
+  bool is_used[256] = { false };
 
-  return 0;
+  for (int n = 0; n < length; n++) { is_used[pixels[n]] = true; }
+
+  for (int n = max_colors - 1; n >= 0; n--)
+  {
+    if (!is_used[n]) { return n; }
+  }
+
+  return -1;
 }
 
 int ImageWriterGif::compute_bits_per_pixel(int max_colors)
@@ -13,8 +13,12 @@
 #define IMAGE_WRITER_GIF_H
 
 #include <stdint.h>
+#include <string.h>
+
+#include <vector>
 
 #include "ImageWriter.h"
+#include "WorkerPool.h"
 
 class ImageWriterGif : public ImageWriter
 {
@@ -26,6 +30,30 @@ public:
   virtual int create_headers();
   virtual int add_frame(uint8_t *image, uint32_t *color_table);
 
+  // Each frame after the first only stores the rectangle that changed
+  // since the one before it. With delta transparency, pixels in that
+  // rectangle that didn't change are written as an unused color marked
+  // transparent, which makes for longer LZW runs. Neither is done when
+  // set_transparent_color_index() is used.
+  void enable_delta_frames(bool value) { do_delta_frames = value; }
+  void enable_delta_transparency(bool value) { do_delta_transparency = value; }
+
+  // Set before the first frame. Frames are copied into a queue of
+  // queue_depth (default count) and, once it's full, compressed on count
+  // threads and written in order.
+  void set_encode_threads(int count, int queue_depth = 0)
+  {
+    encode_threads = count;
+    encode_queue_depth = queue_depth;
+  }
+
+  // Each frame is split into count horizontal strips that are compressed
+  // separately, each starting with a clear code, and joined into one
+  // stream. A frame encoded on its own, such as a still, then spreads its
+  // strips across the encode threads. Costs a little in compression
+  // since each strip starts over with an empty table.
+  void set_encode_strips(int count) { encode_strips = count; }
+
 private:
   struct GifHeader
   {
@@ -53,41 +81,194 @@ private:
     uint8_t color;
   };
 
-  struct CompressNode
+  // LZW codes for (prefix code, color) pairs. A color that repeats the
+  // last color of its prefix is the common case in runs, so those are
+  // looked up in a plain array. Everything else is in an open addressed
+  // hash with twice as many slots as there can be codes.
+  struct LzwDictionary
   {
-    int down;
-    int right;
-    uint8_t color;
+    void clear()
+    {
+      memset(keys, 0, sizeof(keys));
+      memset(repeats, 0xff, sizeof(repeats));
+    }
+
+    int find(int prefix, uint8_t color, bool is_repeat) const
+    {
+      if (is_repeat) { return repeats[prefix]; }
+
+      const uint32_t key = ((prefix << 8) | color) + 1;
+
+      for (int n = hash(key); keys[n] != 0; n = (n + 1) & (HASH_SIZE - 1))
+      {
+        if (keys[n] == key) { return codes[n]; }
+      }
+
+      return -1;
+    }
+
+    void add(int prefix, uint8_t color, bool is_repeat, int code)
+    {
+      if (is_repeat) { repeats[prefix] = code; return; }
+
+      const uint32_t key = ((prefix << 8) | color) + 1;
+      int n = hash(key);
+
+      while (keys[n] != 0) { n = (n + 1) & (HASH_SIZE - 1); }
+
+      keys[n] = key;
+      codes[n] = code;
+    }
+
+    static int hash(uint32_t key)
+    {
+      return (key * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    static const int HASH_BITS = 13;
+    static const int HASH_SIZE = 1 << HASH_BITS;
+
+    uint32_t keys[HASH_SIZE];
+    int16_t codes[HASH_SIZE];
+    int16_t repeats[4096];
   };
 
+  // Codes are packed LSB first into a 64 bit word, which is written out
+  // 4 bytes at a time. The caller makes sure there is room.
   struct BitStream
   {
-    BitStream() : data { 0 }, bitptr { 0 } { }
+    BitStream(uint8_t *output) : output { output }, data { 0 }, bitptr { 0 }, length { 0 } { }
 
-    int size() { return bitptr; }
-    void dump() { printf("--> data=0x%08x bitptr=%d\n", data, bitptr); }
+    void append(uint32_t value, int size)
+    {
+      data |= (uint64_t)value << bitptr;
+      bitptr += size;
+
+      if (bitptr >= 32)
+      {
+        output[length + 0] = data & 0xff;
+        output[length + 1] = (data >> 8) & 0xff;
+        output[length + 2] = (data >> 16) & 0xff;
+        output[length + 3] = (data >> 24) & 0xff;
 
-    uint8_t get_byte()
+        data = data >> 32;
+        bitptr -= 32;
+        length += 4;
+      }
+    }
+
+    // Appends count bits that another BitStream wrote to bytes.
+    void append_bits(const uint8_t *bytes, int count)
     {
-      uint8_t next = data & 0xff;
-      data = data >> 8;
-      bitptr -= 8;
-      return next;
+      for (; count >= 32; count -= 32, bytes += 4)
+      {
+        append(
+          bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24),
+          32);
+      }
+
+      for (; count > 0; count -= 8, bytes++)
+      {
+        const int size = count < 8 ? count : 8;
+
+        append(*bytes & ((1 << size) - 1), size);
+      }
     }
 
-    void append(int value, int size)
+    int get_bit_count() const { return (length * 8) + bitptr; }
+
+    // Writes out what's left, including a partial last byte, and
+    // returns the total number of bytes.
+    int finish()
     {
-      data |= value << bitptr;
-      bitptr += size;
+      while (bitptr > 0)
+      {
+        output[length++] = data & 0xff;
+        data = data >> 8;
+        bitptr -= 8;
+      }
+
+      bitptr = 0;
+
+      return length;
     }
 
-    uint32_t data;
+    uint8_t *output;
+    uint64_t data;
     int bitptr;
+    int length;
+  };
+
+  // One LZW stream, or one horizontal strip of a frame split up so the
+  // strips can be compressed on separate threads.
+  struct Strip
+  {
+    LzwDictionary dictionary;
+    std::vector<uint8_t> codes;
+    const uint8_t *pixels;
+    int length;
+    int bit_count;
+    // Width the code after the last one would be written with.
+    int end_code_size;
+  };
+
+  // Everything needed to compress one frame, so frames can be encoded
+  // on separate threads. Kept between frames so they don't allocate.
+  struct Encoder
+  {
+    // The frame's blocks, ready to write.
+    std::vector<uint8_t> buffer;
+    // Strips stitched back into one stream.
+    std::vector<uint8_t> codes;
+    // Points at the caller's image or at a copy in storage.
+    const uint8_t *pixels;
+    std::vector<uint8_t> storage;
+    int width;
+    int height;
+    std::vector<Strip> strips;
   };
 
+  static void put_uint16(std::vector<uint8_t> &buffer, int value)
+  {
+    buffer.push_back(value & 0xff);
+    buffer.push_back((value >> 8) & 0xff);
+  }
+
   int compute_bits_per_pixel(int max_colors);
 
+  // LZW compresses the encoder's pixels and appends the data blocks to
+  // its buffer.
+  void encode(Encoder &encoder);
+
+  // Compressing a frame in strips is split_strips(), compress() on each
+  // strip, then finish_frame().
+  void split_strips(Encoder &encoder);
+  void compress(Strip &strip, int code_size, bool is_whole);
+  void finish_frame(Encoder &encoder);
+
+  // Encodes the queued frames across the worker pool and writes them
+  // in order.
+  void flush_frames();
+
+  // Bounding box of the pixels that differ from the previous frame.
+  void get_changed_area(const uint8_t *image, int &x0, int &y0, int &x1, int &y1);
+
+  // Highest palette index not used by the pixels, or -1.
+  int get_unused_color(const uint8_t *pixels, int length);
+
   GifHeader gif_header;
+  std::vector<uint8_t> buffer;
+  // One encoder, or one per queued frame with encode threads.
+  std::vector<Encoder> encoders;
+  int queued_count;
+  int encode_threads;
+  int encode_queue_depth;
+  int encode_strips;
+  WorkerPool *worker_pool;
+  bool do_delta_frames;
+  bool do_delta_transparency;
+  // Last frame given to add_frame() when writing delta frames.
+  std::vector<uint8_t> previous;
 };
 
 #endif
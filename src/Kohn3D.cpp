@@ -15,24 +15,116 @@
 #include <string.h>
 #include <math.h>
 
+#include <algorithm>
+
 #include "Kohn3D.h"
+#include "PackedColor.h"
 #include "Angle.h"
 #include "PolarCoords.h"
 
+static int64_t floor_div(int64_t n, int64_t d)
+{
+  if (d < 0) { n = -n; d = -d; }
+
+  int64_t q = n / d;
+  if (q * d != n && n < 0) { q--; }
+
+  return q;
+}
+
+static int64_t ceil_div(int64_t n, int64_t d)
+{
+  return -floor_div(-n, d);
+}
+
+// Narrow first and last to the steps n where 16.16 fixed point
+// value + (n * step) lands on a pixel from lo to hi.
+static bool clip_steps(
+  int64_t value,
+  int64_t step,
+  int lo,
+  int hi,
+  int &first,
+  int &last)
+{
+  int64_t min = ((int64_t)lo << 16) - value;
+  int64_t max = ((int64_t)(hi + 1) << 16) - 1 - value;
+  int64_t n0, n1;
+
+  if (step == 0)
+  {
+    return min <= 0 && max >= 0;
+  }
+    else
+  if (step > 0)
+  {
+    n0 = ceil_div(min, step);
+    n1 = floor_div(max, step);
+  }
+    else
+  {
+    n0 = ceil_div(max, step);
+    n1 = floor_div(min, step);
+  }
+
+  if (n0 > first) { first = n0; }
+  if (n1 < last)  { last = n1; }
+
+  return first <= last;
+}
+
+// Transforms one vertex. x, y and z are truncated to int while fixed_x
+// and fixed_y keep the sub-pixel part for the rasterizer.
+static void transform_vertex(
+  const Transform &transform,
+  int &x, int &y, int &z,
+  int64_t &fixed_x, int64_t &fixed_y,
+  double &w)
+{
+  double tx = x;
+  double ty = y;
+  double tz = z;
+
+  transform.apply(tx, ty, tz, w);
+
+  fixed_x = Rasterizer::to_fixed(tx);
+  fixed_y = Rasterizer::to_fixed(ty);
+
+  x = tx;
+  y = ty;
+  z = tz;
+}
+
 Kohn3D::Kohn3D(int width, int height, Format format) :
   do_alpha_blending { false },
+  do_perspective_correction { false },
+  do_fast_math      { false },
+  cull_mode         { Rasterizer::CULL_NONE },
   is_32bit          { false },
+  is_deferred       { false },
   width             { width },
   height            { height },
   color_count       { 0 },
   //format            { format },
   picture_32bit     { nullptr },
-  image_writer      { nullptr }
+  image_writer      { nullptr },
+  image_writer_gif  { nullptr },
+  worker_pool       { nullptr },
+  tile_columns      { 0 },
+  tile_rows         { 0 },
+  clip_x0           { 0 },
+  clip_y0           { 0 },
+  clip_x1           { width - 1 },
+  clip_y1           { height - 1 },
+  z_block_columns   { (width + Z_BLOCK_SIZE - 1) / Z_BLOCK_SIZE },
+  z_block_rows      { (height + Z_BLOCK_SIZE - 1) / Z_BLOCK_SIZE },
+  clear_color       { 0 }
 {
   switch (format)
   {
     case FORMAT_GIF:
-      image_writer = new ImageWriterGif(width, height);
+      image_writer_gif = new ImageWriterGif(width, height);
+      image_writer = image_writer_gif;
       break;
     case FORMAT_AVI8:
       image_writer = new ImageWriterAvi(width, height, 8);
@@ -54,19 +146,25 @@ Kohn3D::Kohn3D(int width, int height, Format format) :
 
   picture  = (uint8_t *)malloc(width * height * sizeof(uint32_t));
   z_buffer = (int16_t *)malloc(width * height * sizeof(int16_t));
+  z_blocks = (int16_t *)malloc(z_block_columns * z_block_rows * sizeof(int16_t));
 
   if (is_32bit) { picture_32bit = (uint32_t *)picture; }
 
   memset(picture, 0, width * height * sizeof(uint32_t));
 
+  // The z buffer starts out as garbage.
+  mark_dirty(0, 0, width - 1, height - 1, true);
+
   clear();
 }
 
 Kohn3D::~Kohn3D()
 {
   finish();
+  delete worker_pool;
   free(picture);
   free(z_buffer);
+  free(z_blocks);
 }
 
 int Kohn3D::create(const char *filename)
@@ -99,66 +197,112 @@ void Kohn3D::init_end()
 
 void Kohn3D::clear()
 {
-  memset(picture, 0, is_32bit ? width * height * sizeof(uint32_t) : width * height);
+  // Anything recorded would be erased anyway.
+  commands.clear();
 
-  for (int i = 0; i < width * height; i++)
+  if (!dirty.is_empty())
   {
-    z_buffer[i] = -32767;
-  }
-}
+    int length = dirty.x1 - dirty.x0 + 1;
+    int y1 = dirty.y1;
 
-void Kohn3D::draw_line(int x0, int y0, int x1, int y1, uint32_t color)
-{
-  if (y0 == y1)
-  {
-    if (x1 < x0) { exchange(x0, x1); }
-    for (int x = x0; x <= x1; x++) { draw_pixel(x, y0, color); }
-    return;
+    // Whole rows are one run of memory.
+    if (length == width)
+    {
+      length = width * (dirty.y1 - dirty.y0 + 1);
+      y1 = dirty.y0;
+    }
+
+    for (int y = dirty.y0; y <= y1; y++)
+    {
+      int pixel = (y * width) + dirty.x0;
+
+      if (is_32bit)
+      {
+        Span::clear(picture_32bit + pixel, length, clear_color);
+      }
+        else
+      {
+        Span::clear(picture + pixel, length, clear_color);
+      }
+    }
   }
 
-  if (x0 == x1)
+  if (!dirty_z.is_empty())
   {
-    if (y1 < y0) { exchange(y0, y1); }
-    for (int y = y0; y <= y1; y++) { draw_pixel(x0, y, color); }
-    return;
-  }
+    int length = dirty_z.x1 - dirty_z.x0 + 1;
+    int y1 = dirty_z.y1;
 
-  int dx = x0 - x1;
-  int dy = y0 - y1;
+    if (length == width)
+    {
+      length = width * (dirty_z.y1 - dirty_z.y0 + 1);
+      y1 = dirty_z.y0;
+    }
 
-  if (abs(dx) < abs(dy))
-  {
-    if (y0 > y1)
+    for (int y = dirty_z.y0; y <= y1; y++)
     {
-      exchange(x0, x1);
-      exchange(y0, y1);
+      Span::clear(z_buffer + (y * width) + dirty_z.x0, length, (int16_t)-32767);
     }
 
-    double dxdy = (double)(x0 - x1) / (double)(y0 - y1);
-    double x = (double)x0;
+    int bx0 = dirty_z.x0 / Z_BLOCK_SIZE;
+    int by0 = dirty_z.y0 / Z_BLOCK_SIZE;
+    int bx1 = dirty_z.x1 / Z_BLOCK_SIZE;
+    int by1 = dirty_z.y1 / Z_BLOCK_SIZE;
 
-    for (int y = y0; y <= y1; y++)
+    for (int by = by0; by <= by1; by++)
     {
-      draw_pixel((int)x, y, color);
-      x += dxdy;
+      Span::fill(z_blocks + (by * z_block_columns) + bx0, bx1 - bx0 + 1, (int16_t)-32767);
     }
   }
-    else
+
+  dirty.reset();
+  dirty_z.reset();
+}
+
+void Kohn3D::set_clear_color(uint32_t value)
+{
+  clear_color = value;
+
+  // Everything has to be redrawn in the new color.
+  dirty.add(0, 0, width - 1, height - 1);
+}
+
+void Kohn3D::draw_line(int x0, int y0, int x1, int y1, uint32_t color)
+{
+  if (y0 == y1)
   {
-    if (x0 > x1)
-    {
-      exchange(x0, x1);
-      exchange(y0, y1);
-    }
+    draw_rect(x0, y0, x1, y1, color);
+    return;
+  }
 
-    double dydx = (double)(y0 - y1) / (double)(x0 - x1);
-    double y = (double)y0;
+  flush();
 
-    for (int x = x0; x <= x1; x++)
-    {
-      draw_pixel(x, (int)y, color);
-      y += dydx;
-    }
+  int dx = x1 - x0;
+  int dy = y1 - y0;
+  int steps = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+
+  // Position is stepped along the longer axis in 16.16 fixed point. The
+  // step is rounded up so pixels where the line crosses exactly onto a
+  // new row or column aren't lost to truncation.
+  int64_t x = (int64_t)x0 << 16;
+  int64_t y = (int64_t)y0 << 16;
+  const int64_t step_x = ceil_div((int64_t)dx << 16, steps);
+  const int64_t step_y = ceil_div((int64_t)dy << 16, steps);
+
+  int first, last;
+
+  if (!clip_line(x, y, step_x, step_y, steps, first, last)) { return; }
+
+  mark_dirty_line(x, y, step_x, step_y, first, last, false);
+
+  x += first * step_x;
+  y += first * step_y;
+
+  for (int n = first; n <= last; n++)
+  {
+    put_pixel(((y >> 16) * width) + (x >> 16), color, do_alpha_blending);
+
+    x += step_x;
+    y += step_y;
   }
 }
 
@@ -169,7 +313,14 @@ void Kohn3D::draw_line(const PolarCoords &coords, uint32_t color)
   int x0 = coords.get_center_x();
   int y0 = coords.get_center_y();
 
-  coords.to_xy_centered(x1, y1);
+  if (do_fast_math)
+  {
+    coords.to_xy_centered_fast(x1, y1);
+  }
+    else
+  {
+    coords.to_xy_centered(x1, y1);
+  }
 
   draw_line(x0, y0, x1, y1, color);
 }
@@ -179,93 +330,44 @@ void Kohn3D::draw_line(
   int x1, int y1, int z1,
   uint32_t color)
 {
-  double dz, z;
-
-  if (y0 == y1)
-  {
-    if (x1 < x0)
-    {
-      exchange(x0, x1);
-      exchange(z0, z1);
-    }
-
-    z = z0;
-    dz = (double)(z1 - z0) / (double)(x1 - x0);
-
-    for (int x = x0; x <= x1; x++)
-    {
-      draw_pixel(x, y0, color, z);
-      z += dz;
-    }
+  flush();
 
-    return;
-  }
+  int dx = x1 - x0;
+  int dy = y1 - y0;
+  int steps = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
 
-  if (x0 == x1)
+  if (steps == 0)
   {
-    if (x1 < x0)
-    {
-      exchange(y0, y1);
-      exchange(z0, z1);
-    }
-
-    z = z0;
-    dz = (double)(z1 - z0) / (double)(y1 - y0);
-
-    for (int y = y0; y <= y1; y++)
-    {
-      draw_pixel(x0, y, color);
-      z += dz;
-    }
-
+    draw_pixel(x0, y0, color, z0);
     return;
   }
 
-  int dx = (x0 - x1);
-  int dy = (y0 - y1);
+  int64_t x = (int64_t)x0 << 16;
+  int64_t y = (int64_t)y0 << 16;
+  int64_t z = (int64_t)z0 << 16;
+  const int64_t step_x = ceil_div((int64_t)dx << 16, steps);
+  const int64_t step_y = ceil_div((int64_t)dy << 16, steps);
+  const int64_t step_z = ((int64_t)(z1 - z0) << 16) / steps;
 
-  if (abs(dx) < abs(dy))
-  {
-    if (y0 > y1)
-    {
-      exchange(x0, x1);
-      exchange(y0, y1);
-      exchange(z0, z1);
-    }
+  int first, last;
 
-    double dxdy = (double)(x0 - x1) / (double)(y0 - y1);
-    double x = (double)x0;
+  if (!clip_line(x, y, step_x, step_y, steps, first, last)) { return; }
 
-    z = z0;
-    dz = (double)(z1 - z0) / (double)(y1 - y0);
+  mark_dirty_line(x, y, step_x, step_y, first, last, true);
 
-    for (int y = y0; y <= y1; y++)
-    {
-      draw_pixel((int)x, y, color, z);
-      x += dxdy;
-      z += dz;
-    }
-  }
-    else
+  x += first * step_x;
+  y += first * step_y;
+  z += first * step_z;
+
+  for (int n = first; n <= last; n++)
   {
-    if (x0 > x1)
-    {
-      exchange(x0, x1);
-      exchange(y0, y1);
-      exchange(z0, z1);
-    }
+    int pixel = ((y >> 16) * width) + (x >> 16);
 
-    double dydx = (double)(y0 - y1) / (double)(x0 - x1);
-    double y = (double)y0;
-    z = z0;
-    dz = (double)(z1 - z0) / (double)(y1 - y0);
+    put_pixel(pixel, color, do_alpha_blending, z >> 16);
 
-    for (int x = x0; x <= x1; x++)
-    {
-      draw_pixel(x, (int)y, color, z);
-      y += dydx;
-      z += dz;
-    }
+    x += step_x;
+    y += step_y;
+    z += step_z;
   }
 }
 
@@ -275,117 +377,64 @@ void Kohn3D::draw_line(
   Texture &texture,
   int center_x, int center_y)
 {
-  double dz, z;
-  uint32_t color;
-
-  if (y0 == y1)
-  {
-    if (x1 < x0)
-    {
-      exchange(x0, x1);
-      exchange(z0, z1);
-    }
+  flush();
 
-    z = z0;
-    dz = (double)(z1 - z0) / (double)(x1 - x0);
+  int dx = x1 - x0;
+  int dy = y1 - y0;
+  int steps = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
 
-    for (int x = x0; x <= x1; x++)
-    {
-      color = texture.get_pixel(x, y0);
-
-      draw_pixel(x, y0, color, z);
-      z += dz;
-    }
-
-    return;
-  }
+  // A line with no length still draws a single pixel.
+  int divisor = steps == 0 ? 1 : steps;
 
-  if (x0 == x1)
-  {
-    if (x1 < x0)
-    {
-      exchange(y0, y1);
-      exchange(z0, z1);
-    }
-
-    z = z0;
-    dz = (double)(z1 - z0) / (double)(y1 - y0);
-
-    for (int y = y0; y <= y1; y++)
-    {
-      double p;
-      int r;
+  int64_t x = (int64_t)x0 << 16;
+  int64_t y = (int64_t)y0 << 16;
+  int64_t z = (int64_t)z0 << 16;
+  const int64_t step_x = ceil_div((int64_t)dx << 16, divisor);
+  const int64_t step_y = ceil_div((int64_t)dy << 16, divisor);
+  const int64_t step_z = ((int64_t)(z1 - z0) << 16) / divisor;
 
-      PolarCoords::from_xy(p, r, center_x - x0, center_y - y);
+  int first, last;
 
-      //color = texture.get_pixel(x0, y);
-      color = texture.get_pixel(p, r);
-      draw_pixel(x0, y, color);
-      z += dz;
-    }
+  if (!clip_line(x, y, step_x, step_y, steps, first, last)) { return; }
 
-    return;
-  }
+  mark_dirty_line(x, y, step_x, step_y, first, last, true);
 
-  int dx = (x0 - x1);
-  int dy = (y0 - y1);
+  x += first * step_x;
+  y += first * step_y;
+  z += first * step_z;
 
-  if (abs(dx) < abs(dy))
+  for (int n = first; n <= last; n++)
   {
-    if (y0 > y1)
+    int px = x >> 16;
+    int py = y >> 16;
+    uint32_t color;
+
+    if (dy == 0)
     {
-      exchange(x0, x1);
-      exchange(y0, y1);
-      exchange(z0, z1);
+      color = texture.get_pixel(px, py);
     }
-
-    double dxdy = (double)(x0 - x1) / (double)(y0 - y1);
-    double x = (double)x0;
-
-    z = z0;
-    dz = (double)(z1 - z0) / (double)(y1 - y0);
-
-    for (int y = y0; y <= y1; y++)
+      else
     {
       double p;
       int r;
 
-      PolarCoords::from_xy(p, r, center_x - x, center_y - y);
+      if (do_fast_math)
+      {
+        PolarCoords::from_xy_fast(p, r, center_x - px, center_y - py);
+      }
+        else
+      {
+        PolarCoords::from_xy(p, r, center_x - px, center_y - py);
+      }
 
-      //color = texture.get_pixel(x, y);
       color = texture.get_pixel(p, r);
-      draw_pixel((int)x, y, color, z);
-      x += dxdy;
-      z += dz;
-    }
-  }
-    else
-  {
-    if (x0 > x1)
-    {
-      exchange(x0, x1);
-      exchange(y0, y1);
-      exchange(z0, z1);
     }
 
-    double dydx = (double)(y0 - y1) / (double)(x0 - x1);
-    double y = (double)y0;
-    z = z0;
-    dz = (double)(z1 - z0) / (double)(y1 - y0);
-
-    for (int x = x0; x <= x1; x++)
-    {
-      double p;
-      int r;
-
-      PolarCoords::from_xy(p, r, center_x - x, center_y - y);
+    put_pixel((py * width) + px, color, do_alpha_blending, z >> 16);
 
-      //color = texture.get_pixel(x, y);
-      color = texture.get_pixel(p, r);
-      draw_pixel(x, (int)y, color, z);
-      y += dydx;
-      z += dz;
-    }
+    x += step_x;
+    y += step_y;
+    z += step_z;
   }
 }
 
@@ -395,210 +444,87 @@ void Kohn3D::draw_line(
   int a0, int r0, int g0, int b0,
   int a1, int r1, int g1, int b1)
 {
-  uint32_t color;
-  double dz, z;
-  double da, a;
-  double dr, r;
-  double dg, g;
-  double db, b;
-
-  if (y0 == y1)
+  int dx = x1 - x0;
+  int dy = y1 - y0;
+  int steps = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+
+  // Position, depth and the color channels are all stepped along the
+  // longer axis in 16.16 fixed point.
+  PackedColor color;
+  color.set(
+    (a0 << 16) + 0x8000,
+    (r0 << 16) + 0x8000,
+    (g0 << 16) + 0x8000,
+    (b0 << 16) + 0x8000);
+
+  if (steps == 0)
   {
-    if (x1 < x0)
-    {
-      exchange(x0, x1);
-      exchange(z0, z1);
-      exchange(a0, a1);
-      exchange(r0, r1);
-      exchange(g0, g1);
-      exchange(b0, b1);
-    }
-
-    double dx = (double)(x1 - x0);
-
-    z = z0;
-    a = a0;
-    r = r0;
-    g = g0;
-    b = b0;
-    dz = (double)(z1 - z0) / dx;
-    da = (double)(a1 - a0) / dx;
-    dr = (double)(r1 - r0) / dx;
-    dg = (double)(g1 - g0) / dx;
-    db = (double)(b1 - b0) / dx;
-
-    for (int x = x0; x <= x1; x++)
-    {
-      color =
-        ((uint32_t)a << 24) |
-        ((uint32_t)r << 16) |
-        ((uint32_t)g << 8) |
-         (uint32_t)b;
-
-      draw_pixel(x, y0, color, z);
-
-      z += dz;
-      a += da;
-      r += dr;
-      g += dg;
-      b += db;
-    }
-
+    draw_pixel(x0, y0, color.get(), z0);
     return;
   }
 
-  if (x0 == x1)
-  {
-    if (x1 < x0)
-    {
-      exchange(y0, y1);
-      exchange(z0, z1);
-      exchange(a0, a1);
-      exchange(r0, r1);
-      exchange(g0, g1);
-      exchange(b0, b1);
-    }
-
-    double dy = (double)(y1 - y0);
-
-    z = z0;
-    a = a0;
-    r = r0;
-    g = g0;
-    b = b0;
-    dz = (double)(z1 - z0) / dy;
-    da = (double)(a1 - a0) / dy;
-    dr = (double)(r1 - r0) / dy;
-    dg = (double)(g1 - g0) / dy;
-    db = (double)(b1 - b0) / dy;
-
-    for (int y = y0; y <= y1; y++)
-    {
-      color =
-        ((uint32_t)a << 24) |
-        ((uint32_t)r << 16) |
-        ((uint32_t)g << 8) |
-         (uint32_t)b;
-
-      draw_pixel(x0, y, color);
+  flush();
 
-      z += dz;
-      a += da;
-      r += dr;
-      g += dg;
-      b += db;
-    }
+  const int32_t step_a = ((a1 - a0) << 16) / steps;
+  const int32_t step_r = ((r1 - r0) << 16) / steps;
+  const int32_t step_g = ((g1 - g0) << 16) / steps;
+  const int32_t step_b = ((b1 - b0) << 16) / steps;
 
-    return;
-  }
+  int64_t x = ((int64_t)x0 << 16) + 0x8000;
+  int64_t y = ((int64_t)y0 << 16) + 0x8000;
+  int64_t z = ((int64_t)z0 << 16) + 0x8000;
+  const int64_t step_x = ceil_div((int64_t)dx << 16, steps);
+  const int64_t step_y = ceil_div((int64_t)dy << 16, steps);
+  const int64_t step_z = ((int64_t)(z1 - z0) << 16) / steps;
 
-  int dx = (x0 - x1);
-  int dy = (y0 - y1);
+  int first, last;
 
-  if (abs(dx) < abs(dy))
-  {
-    if (y0 > y1)
-    {
-      exchange(x0, x1);
-      exchange(y0, y1);
-      exchange(z0, z1);
-      exchange(r0, r1);
-      exchange(g0, g1);
-      exchange(b0, b1);
-    }
+  if (!clip_line(x, y, step_x, step_y, steps, first, last)) { return; }
 
-    double dy = (double)(y0 - y1);
-    double dxdy = (double)(x0 - x1) / dy;
-    double x = (double)x0;
-
-    z = z0;
-    a = a0;
-    r = r0;
-    g = g0;
-    b = b0;
-    dz = (double)(z0 - z1) / dy;
-    da = (double)(a0 - a1) / dy;
-    dr = (double)(r0 - r1) / dy;
-    dg = (double)(g0 - g1) / dy;
-    db = (double)(b0 - b1) / dy;
+  mark_dirty_line(x, y, step_x, step_y, first, last, true);
 
-    for (int y = y0; y <= y1; y++)
-    {
-      color =
-        ((uint32_t)a << 24) |
-        ((uint32_t)r << 16) |
-        ((uint32_t)g << 8) |
-         (uint32_t)b;
+  x += first * step_x;
+  y += first * step_y;
+  z += first * step_z;
 
-      draw_pixel((int)x, y, color, z);
+  color.set(
+    (a0 << 16) + 0x8000 + (first * step_a),
+    (r0 << 16) + 0x8000 + (first * step_r),
+    (g0 << 16) + 0x8000 + (first * step_g),
+    (b0 << 16) + 0x8000 + (first * step_b));
+  color.set_step(step_a, step_r, step_g, step_b);
 
-      x += dxdy;
-      z += dz;
-      a += da;
-      r += dr;
-      g += dg;
-      b += db;
-    }
-  }
-    else
+  for (int n = first; n <= last; n++)
   {
-    if (x0 > x1)
-    {
-      exchange(x0, x1);
-      exchange(y0, y1);
-      exchange(z0, z1);
-      exchange(r0, r1);
-      exchange(g0, g1);
-      exchange(b0, b1);
-    }
-
-    double dydx = (double)(y0 - y1) / (double)(x0 - x1);
-    double y = (double)y0;
-
-    z = z0;
-    a = a0;
-    r = r0;
-    g = g0;
-    b = b0;
-    double dy = (double)(y0 - y1);
-    dz = (double)(z0 - z1) / dy;
-    da = (double)(a0 - a1) / dy;
-    dr = (double)(r0 - r1) / dy;
-    dg = (double)(g0 - g1) / dy;
-    db = (double)(b0 - b1) / dy;
-
-    for (int x = x0; x <= x1; x++)
-    {
-      color =
-        ((uint32_t)a << 24) |
-        ((uint32_t)r << 16) |
-        ((uint32_t)g << 8) |
-         (uint32_t)b;
+    int pixel = ((y >> 16) * width) + (x >> 16);
 
-      draw_pixel(x, (int)y, color, z);
+    put_pixel(pixel, color.get(), do_alpha_blending, z >> 16);
 
-      y += dydx;
-      z += dz;
-      a += da;
-      r += dr;
-      g += dg;
-      b += db;
-    }
+    x += step_x;
+    y += step_y;
+    z += step_z;
+    color.step();
   }
 }
 
 void Kohn3D::draw_rect(int x0, int y0, int x1, int y1, uint32_t color)
 {
-  if (x0 > x1) { exchange(x0, x1); }
-  if (y0 > y1) { exchange(y0, y1); }
+  if (!clip_rect(x0, y0, x1, y1)) { return; }
 
-  for (int y = y0; y <= y1; y++)
-  {
-    for (int x = x0; x <= x1; x++)
-    {
-      draw_pixel(x, y, color);
-    }
-  }
+  DrawCommand command;
+
+  mark_dirty(x0, y0, x1, y1, false);
+
+  command.type = DrawCommand::RECT;
+  command.color = color;
+  command.alpha_blend = do_alpha_blending;
+  command.depth = INT32_MIN;
+  command.x0 = x0;
+  command.y0 = y0;
+  command.x1 = x1;
+  command.y1 = y1;
+
+  record(command);
 }
 
 void Kohn3D::draw_rect(
@@ -607,16 +533,22 @@ void Kohn3D::draw_rect(
   uint32_t color,
   int z)
 {
-  if (x0 > x1) { exchange(x0, x1); }
-  if (y0 > y1) { exchange(y0, y1); }
+  if (!clip_rect(x0, y0, x1, y1)) { return; }
 
-  for (int y = y0; y <= y1; y++)
-  {
-    for (int x = x0; x <= x1; x++)
-    {
-      draw_pixel(x, y, color, z);
-    }
-  }
+  DrawCommand command;
+
+  mark_dirty(x0, y0, x1, y1, true);
+
+  command.type = DrawCommand::RECT_DEPTH;
+  command.color = color;
+  command.alpha_blend = do_alpha_blending;
+  command.depth = z;
+  command.x0 = x0;
+  command.y0 = y0;
+  command.x1 = x1;
+  command.y1 = y1;
+
+  record(command);
 }
 
 void Kohn3D::load_triangle(Triangle &triangle, const int coords[])
@@ -645,432 +577,256 @@ void Kohn3D::draw_triangle(
   int y,
   uint32_t color)
 {
-  Triangle v = triangle;
-
-  sort_vertexes(v);
+  DrawCommand command;
 
-  if (v.y0 == v.y1)
-  {
-    double dxdy_0 = (double)(v.x2 - v.x0) / (double)(v.y2 - v.y0);
-    double dxdy_1 = (double)(v.x2 - v.x1) / (double)(v.y2 - v.y1);
-    double x0 = v.x0;
-    double x1 = v.x1;
-
-    for (int y0 = v.y0; y0 < v.y2; y0++)
-    {
-      draw_line((int)x0 + x, y0 + y, (int)x1 + x, y0 + y, color);
-
-      x0 += dxdy_0;
-      x1 += dxdy_1;
-    }
+  command.type = DrawCommand::FLAT;
+  command.v = triangle;
+  command.color = color;
 
-    return;
-  }
+  translation(command, x, y, 0);
+  submit(command);
+}
 
-  double dxdy_0 = (double)(v.x2 - v.x0) / (double)(v.y2 - v.y0);
-  double x0, x1;
-  double dxdy_1;
+void Kohn3D::draw_triangle(
+  const Triangle &triangle,
+  int x,
+  int y,
+  int z,
+  uint32_t color)
+{
+  draw_triangle(triangle, Rotation(), x, y, z, color);
+}
 
-  dxdy_1 = (double)(v.x1 - v.x0) / (double)(v.y1 - v.y0);
-
-  x0 = x1 = v.x0;
-
-  for (int y0 = v.y0; y0 < v.y1; y0++)
-  {
-    draw_line((int)x0 + x, y0 + y, (int)x1 + x, y0 + y, color);
-
-    x0 += dxdy_0;
-    x1 += dxdy_1;
-  }
-
-  dxdy_1 = (double)(v.x2 - v.x1) / (double)(v.y2 - v.y1);
-
-  for (int y0 = v.y1; y0 < v.y2; y0++)
-  {
-    draw_line((int)x0 + x, y0 + y, (int)x1 + x, y0 + y, color);
+void Kohn3D::draw_triangle(
+  const Triangle &triangle,
+  int x,
+  int y,
+  int z,
+  uint32_t *colors)
+{
+  draw_triangle(triangle, Rotation(), x, y, z, colors);
+}
 
-    x0 += dxdy_0;
-    x1 += dxdy_1;
-  }
+void Kohn3D::draw_triangle(
+  const Triangle &triangle,
+  int x,
+  int y,
+  int z,
+  Texture &texture)
+{
+  draw_triangle(triangle, Rotation(), x, y, z, texture);
 }
 
 void Kohn3D::draw_triangle(
   const Triangle &triangle,
+  const Rotation &rotation,
   int x,
   int y,
   int z,
   uint32_t color)
 {
-  Triangle v = triangle;
-
-  translation(v, x, y, z);
-  projection(v);
-
-  sort_vertexes(v);
-
-  if (v.y0 == v.y1)
-  {
-    double dxdy_0 = (double)(v.x2 - v.x0) / (double)(v.y2 - v.y0);
-    double dxdy_1 = (double)(v.x2 - v.x1) / (double)(v.y2 - v.y1);
-    double dzdy_0 = (double)(v.z2 - v.z0) / (double)(v.y2 - v.y0);
-    double dzdy_1 = (double)(v.z2 - v.z1) / (double)(v.y2 - v.y1);
-    double x0 = v.x0;
-    double x1 = v.x1;
-    double z0 = v.z0;
-    double z1 = v.z1;
-
-    for (int y0 = v.y0; y0 < v.y2; y0++)
-    {
-      draw_line((int)x0, y0, (int)z0, (int)x1, y0, (int)z1, color);
-
-      x0 += dxdy_0;
-      x1 += dxdy_1;
-      z0 += dzdy_0;
-      z1 += dzdy_1;
-    }
-
-    return;
-  }
-
-  double dxdy_0 = (double)(v.x2 - v.x0) / (double)(v.y2 - v.y0);
-  double dzdy_0 = (double)(v.z2 - v.z0) / (double)(v.y2 - v.y0);
-  double x0, x1;
-  double z0, z1;
-  double dxdy_1;
-  double dzdy_1;
-
-  dxdy_1 = (double)(v.x1 - v.x0) / (double)(v.y1 - v.y0);
-  dzdy_1 = (double)(v.z1 - v.z0) / (double)(v.y1 - v.y0);
+  Transform transform;
+  load_transform(transform, rotation, x, y, z);
 
-  x0 = x1 = v.x0;
-  z0 = z1 = v.z0;
-
-  for (int y0 = v.y0; y0 < v.y1; y0++)
-  {
-    draw_line((int)x0, y0, (int)z0, (int)x1, y0, (int)z1, color);
-
-    x0 += dxdy_0;
-    x1 += dxdy_1;
-    z0 += dzdy_0;
-    z1 += dzdy_1;
-  }
-
-  dxdy_1 = (double)(v.x2 - v.x1) / (double)(v.y2 - v.y1);
-  dzdy_1 = (double)(v.z2 - v.z1) / (double)(v.y2 - v.y1);
-
-  for (int y0 = v.y1; y0 < v.y2; y0++)
-  {
-    draw_line((int)x0, y0, (int)z0, (int)x1, y0, (int)z1, color);
-
-    x0 += dxdy_0;
-    x1 += dxdy_1;
-    z0 += dzdy_0;
-    z1 += dzdy_1;
-  }
+  draw_triangle(triangle, transform, color);
 }
 
 void Kohn3D::draw_triangle(
   const Triangle &triangle,
+  const Rotation &rotation,
   int x,
   int y,
   int z,
   uint32_t *colors)
 {
-  Triangle v = triangle;
-
-  translation(v, x, y, z);
-  projection(v);
-
-  sort_vertexes(v, colors);
-
-  double a0, r0, g0, b0;
-  double a1, r1, g1, b1;
-  double a2, r2, g2, b2;
-
-  split_rgb(colors[0], a0, r0, g0, b0);
-  split_rgb(colors[1], a1, r1, g1, b1);
-  split_rgb(colors[2], a2, r2, g2, b2);
+  Transform transform;
+  load_transform(transform, rotation, x, y, z);
 
-  double delta_y1y0 = (double)(v.y1 - v.y0);
-  double delta_y2y0 = (double)(v.y2 - v.y0);
-  double delta_y2y1 = (double)(v.y2 - v.y1);
-
-  if (v.y0 == v.y1)
-  {
-    double dxdy_0 = (double)(v.x2 - v.x0) / delta_y2y0;;
-    double dxdy_1 = (double)(v.x2 - v.x1) / delta_y2y1;
-    double dzdy_0 = (double)(v.z2 - v.z0) / delta_y2y0;
-    double dzdy_1 = (double)(v.z2 - v.z1) / delta_y2y1;
-    double x0 = v.x0;
-    double x1 = v.x1;
-    double z0 = v.z0;
-    double z1 = v.z1;
-
-    double da0dy = (a2 - a0) / delta_y2y0;
-    double dr0dy = (r2 - r0) / delta_y2y0;
-    double dg0dy = (g2 - g0) / delta_y2y0;
-    double db0dy = (b2 - b0) / delta_y2y0;
-    double da1dy = (a2 - a1) / delta_y2y1;
-    double dr1dy = (r2 - r1) / delta_y2y1;
-    double dg1dy = (g2 - g1) / delta_y2y1;
-    double db1dy = (b2 - b1) / delta_y2y1;
-
-    for (int y0 = v.y0; y0 < v.y2; y0++)
-    {
-      draw_line((int)x0, y0, (int)z0, (int)x1, y0, (int)z1, a0, r0, g0, b0, a1, r1, g1, b1);
-
-      x0 += dxdy_0;
-      x1 += dxdy_1;
-      z0 += dzdy_0;
-      z1 += dzdy_1;
-      a0 += da0dy;
-      r0 += dr0dy;
-      g0 += dg0dy;
-      b0 += db0dy;
-      a1 += da1dy;
-      r1 += dr1dy;
-      g1 += dg1dy;
-      b1 += db1dy;
-    }
-
-    return;
-  }
-
-  double dxdy_0 = (double)(v.x2 - v.x0) / delta_y2y0;
-  double dzdy_0 = (double)(v.z2 - v.z0) / delta_y2y0;
-  double x0, x1;
-  double z0, z1;
-  double dxdy_1;
-  double dzdy_1;
-
-  dxdy_1 = (double)(v.x1 - v.x0) / delta_y1y0;
-  dzdy_1 = (double)(v.z1 - v.z0) / delta_y1y0;
-
-  double daedy = (a2 - a0) / delta_y2y0;
-  double dredy = (r2 - r0) / delta_y2y0;
-  double dgedy = (g2 - g0) / delta_y2y0;
-  double dbedy = (b2 - b0) / delta_y2y0;
-
-  double dady_0 = (a1 - a0) / delta_y1y0;
-  double drdy_0 = (r1 - r0) / delta_y1y0;
-  double dgdy_0 = (g1 - g0) / delta_y1y0;
-  double dbdy_0 = (b1 - b0) / delta_y1y0;
-
-  double ae = a0;
-  double re = r0;
-  double ge = g0;
-  double be = b0;
-
-  x0 = x1 = v.x0;
-  z0 = z1 = v.z0;
-
-  for (int y0 = v.y0; y0 < v.y1; y0++)
-  {
-    draw_line((int)x0, y0, (int)z0, (int)x1, y0, (int)z1, ae, re, ge, be, a0, r0, g0, b0);
-
-    x0 += dxdy_0;
-    x1 += dxdy_1;
-    z0 += dzdy_0;
-    z1 += dzdy_1;
-
-    ae += daedy;
-    re += dredy;
-    ge += dgedy;
-    be += dbedy;
-    a0 += dady_0;
-    r0 += drdy_0;
-    g0 += dgdy_0;
-    b0 += dbdy_0;
-  }
-
-  dxdy_1 = (double)(v.x2 - v.x1) / delta_y2y1;
-  dzdy_1 = (double)(v.z2 - v.z1) / delta_y2y1;
-
-  double dady_1 = (a1 - a0) / delta_y1y0;
-  double drdy_1 = (r1 - r0) / delta_y1y0;
-  double dgdy_1 = (g1 - g0) / delta_y1y0;
-  double dbdy_1 = (b1 - b0) / delta_y1y0;
-
-  for (int y0 = v.y1; y0 < v.y2; y0++)
-  {
-    draw_line((int)x0, y0, (int)z0, (int)x1, y0, (int)z1, ae, re, ge, be, a0, r0, g0, b0);
-
-    x0 += dxdy_0;
-    x1 += dxdy_1;
-    z0 += dzdy_0;
-    z1 += dzdy_1;
-
-    ae += daedy;
-    re += dredy;
-    ge += dgedy;
-    be += dbedy;
-    a0 += dady_1;
-    r0 += drdy_1;
-    g0 += dgdy_1;
-    b0 += dbdy_1;
-  }
+  draw_triangle(triangle, transform, colors);
 }
 
 void Kohn3D::draw_triangle(
   const Triangle &triangle,
+  const Rotation &rotation,
   int x,
   int y,
   int z,
   Texture &texture)
 {
-  Triangle v = triangle;
+  Transform transform;
+  load_transform(transform, rotation, x, y, z);
 
-  translation(v, x, y, z);
-  projection(v);
+  draw_triangle(triangle, transform, texture);
+}
 
-  texture.set_image_angle(v.x0, v.y0, v.x1, v.y1, v.x2, v.y2);
+void Kohn3D::draw_triangle(
+  const Triangle &triangle,
+  const Transform &transform,
+  uint32_t color)
+{
+  DrawCommand command;
 
-  int center_x = v.x1;
-  int center_y = v.y1;
+  command.type = DrawCommand::DEPTH;
+  command.v = triangle;
+  command.color = color;
 
-  sort_vertexes(v, texture);
+  apply_transform(command, transform);
+  submit(command);
+}
 
-  //texture.set_scale(polar_a, polar_b);
+void Kohn3D::draw_triangle(
+  const Triangle &triangle,
+  const Transform &transform,
+  uint32_t *colors)
+{
+  DrawCommand command;
 
-  if (v.y0 == v.y1)
-  {
-    double dxdy_0 = (double)(v.x2 - v.x0) / (double)(v.y2 - v.y0);
-    double dxdy_1 = (double)(v.x2 - v.x1) / (double)(v.y2 - v.y1);
-    double dzdy_0 = (double)(v.z2 - v.z0) / (double)(v.y2 - v.y0);
-    double dzdy_1 = (double)(v.z2 - v.z1) / (double)(v.y2 - v.y1);
-    double x0 = v.x0;
-    double x1 = v.x1;
-    double z0 = v.z0;
-    double z1 = v.z1;
-
-    for (int y0 = v.y0; y0 < v.y2; y0++)
-    {
-      draw_line(
-        (int)x0, y0, (int)z0,
-        (int)x1, y0, (int)z1,
-        texture, center_x, center_y);
-
-      x0 += dxdy_0;
-      x1 += dxdy_1;
-      z0 += dzdy_0;
-      z1 += dzdy_1;
-    }
+  command.type = DrawCommand::COLORS;
+  command.v = triangle;
+  command.colors[0] = colors[0];
+  command.colors[1] = colors[1];
+  command.colors[2] = colors[2];
 
-    return;
-  }
+  apply_transform(command, transform);
+  submit(command);
+}
 
-  double dxdy_0 = (double)(v.x2 - v.x0) / (double)(v.y2 - v.y0);
-  double dzdy_0 = (double)(v.z2 - v.z0) / (double)(v.y2 - v.y0);
-  double x0, x1;
-  double z0, z1;
-  double dxdy_1;
-  double dzdy_1;
+void Kohn3D::draw_triangle(
+  const Triangle &triangle,
+  const Transform &transform,
+  Texture &texture)
+{
+  DrawCommand command;
 
-  dxdy_1 = (double)(v.x1 - v.x0) / (double)(v.y1 - v.y0);
-  dzdy_1 = (double)(v.z1 - v.z0) / (double)(v.y1 - v.y0);
+  command.type = DrawCommand::TEXTURE;
+  command.v = triangle;
+  command.texture = &texture;
 
-  x0 = x1 = v.x0;
-  z0 = z1 = v.z0;
+  double w[3];
 
-  for (int y0 = v.y0; y0 < v.y1; y0++)
-  {
-    draw_line(
-      (int)x0, y0, (int)z0,
-      (int)x1, y0, (int)z1,
-      texture, center_x, center_y);
-
-    x0 += dxdy_0;
-    x1 += dxdy_1;
-    z0 += dzdy_0;
-    z1 += dzdy_1;
-  }
+  apply_transform(command, transform, w);
 
-  dxdy_1 = (double)(v.x2 - v.x1) / (double)(v.y2 - v.y1);
-  dzdy_1 = (double)(v.z2 - v.z1) / (double)(v.y2 - v.y1);
+  const Texture::AreaUV &coords = texture.get_coords();
+  const double u[3] = { coords.u0, coords.u1, coords.u2 };
+  const double v[3] = { coords.v0, coords.v1, coords.v2 };
 
-  for (int y0 = v.y1; y0 < v.y2; y0++)
+  for (int n = 0; n < 3; n++)
   {
-    draw_line(
-      (int)x0, y0, (int)z0,
-      (int)x1, y0, (int)z1,
-      texture, center_x, center_y);
-
-    x0 += dxdy_0;
-    x1 += dxdy_1;
-    z0 += dzdy_0;
-    z1 += dzdy_1;
+    double q = do_perspective_correction && w[n] != 0.0 ? 1.0 / w[n] : 1.0;
+
+    command.texture_u[n] = u[n] * texture.get_width() * q;
+    command.texture_v[n] = v[n] * texture.get_height() * q;
+    command.texture_q[n] = q;
   }
+
+  submit(command);
 }
 
-void Kohn3D::draw_triangle(
-  const Triangle &triangle,
+void Kohn3D::draw_mesh(
+  const Mesh &mesh,
   const Rotation &rotation,
   int x,
   int y,
   int z,
   uint32_t color)
 {
-  Triangle v = triangle;
+  Transform transform;
+  load_transform(transform, rotation, x, y, z);
 
-  rotate(v, rotation);
-  draw_triangle(v, x, y, z, color);
+  draw_mesh(mesh, transform, color);
 }
 
-void Kohn3D::draw_triangle(
-  const Triangle &triangle,
+void Kohn3D::draw_mesh(
+  const Mesh &mesh,
   const Rotation &rotation,
   int x,
   int y,
   int z,
-  uint32_t *colors)
+  const uint32_t *triangle_colors)
 {
-  Triangle v = triangle;
+  Transform transform;
+  load_transform(transform, rotation, x, y, z);
 
-  rotate(v, rotation);
-  draw_triangle(v, x, y, z, colors);
+  draw_mesh(mesh, transform, triangle_colors);
 }
 
-void Kohn3D::draw_triangle(
-  const Triangle &triangle,
+void Kohn3D::draw_mesh(
+  const Mesh &mesh,
   const Rotation &rotation,
   int x,
   int y,
-  int z,
-  Texture &texture)
+  int z)
+{
+  Transform transform;
+  load_transform(transform, rotation, x, y, z);
+
+  draw_mesh(mesh, transform);
+}
+
+void Kohn3D::draw_mesh(
+  const Mesh &mesh,
+  const Transform &transform,
+  uint32_t color)
 {
-  Triangle v = triangle;
+  transform_mesh(mesh, transform);
+  submit_mesh(mesh, DrawCommand::DEPTH, color, nullptr);
+}
 
-  rotate(v, rotation);
-  draw_triangle(v, x, y, z, texture);
+void Kohn3D::draw_mesh(
+  const Mesh &mesh,
+  const Transform &transform,
+  const uint32_t *triangle_colors)
+{
+  transform_mesh(mesh, transform);
+  submit_mesh(mesh, DrawCommand::DEPTH, 0, triangle_colors);
+}
+
+void Kohn3D::draw_mesh(const Mesh &mesh, const Transform &transform)
+{
+  transform_mesh(mesh, transform);
+  submit_mesh(mesh, DrawCommand::COLORS, 0, nullptr);
+}
+
+void Kohn3D::load_transform(
+  Transform &transform,
+  const Rotation &rotation,
+  int x,
+  int y,
+  int z)
+{
+  // Weak perspective projection.
+  //const double scale = -16738.0;
+  const double scale = -1024.0;
+
+  transform.set_rotation(rotation.rx, rotation.ry, rotation.rz);
+  transform.translate(x, y, z);
+  transform.project(scale);
 }
 
 void Kohn3D::draw_picture(Picture &picture, int x0, int y0, int z)
 {
-  int w = picture.get_width();
-  int h = picture.get_height();
-  int y = y0;
+  if (picture.get_width() <= 0 || picture.get_height() <= 0) { return; }
 
-  for (int m = 0; m < h; m++)
-  {
-    int x = x0;
+  flush();
 
-    for (int n = 0; n < w; n++)
-    {
-      uint32_t color = picture.get_pixel(n, m);
+  int x1 = x0 + picture.get_width() - 1;
+  int y1 = y0 + picture.get_height() - 1;
+  int sx0 = x0, sy0 = y0;
 
-      if (z == INT32_MIN)
-      {
-        draw_pixel(x, y, color);
-      }
-        else
-      {
-        draw_pixel(x, y, color, z);
-      }
+  // Only the part of the picture inside the clip is walked.
+  if (!clip_rect(sx0, sy0, x1, y1)) { return; }
 
-      x++;
-    }
+  mark_dirty(sx0, sy0, x1, y1, z != INT32_MIN);
 
-    y++;
+  // Clipped once above, so whole rows go straight from the picture.
+  const uint32_t *source =
+    picture.get_data() + ((sy0 - y0) * picture.get_width()) + (sx0 - x0);
+
+  for (int y = sy0; y <= y1; y++)
+  {
+    copy_span(y, sx0, x1, source, do_alpha_blending, z);
+
+    source += picture.get_width();
   }
 }
 
@@ -1082,34 +838,63 @@ void Kohn3D::draw_picture(
   int height,
   int z)
 {
-  int w = picture.get_width();
-  int h = picture.get_height();
+  if (width <= 0 || height <= 0) { return; }
+
+  flush();
+
+  // With mipmaps this samples the smallest level that doesn't need to
+  // shrink by half or more.
+  const Picture::Mipmap mipmap = picture.get_mipmap(width, height);
+  const int w = mipmap.width;
+  const int h = mipmap.height;
+
+  int x1 = x0 + width - 1;
+  int y1 = y0 + height - 1;
+  int sx0 = x0, sy0 = y0;
+
+  if (!clip_rect(sx0, sy0, x1, y1)) { return; }
 
-  double scale_x = (double)w / (double)width;
-  double scale_y = (double)h / (double)height;
-  double v = 0.0;
+  mark_dirty(sx0, sy0, x1, y1, z != INT32_MIN);
 
-  for (int y = 0; y < height; y++)
+  // Source positions are 32.32 fixed point. Rounding the step up makes
+  // (n * step) >> 32 exactly (n * w) / width for any size under 64k, so
+  // the clip never changes which texels are picked.
+  const int64_t step_x = ceil_div((int64_t)w << 32, width);
+  const int64_t step_y = ceil_div((int64_t)h << 32, height);
+  const int length = x1 - sx0 + 1;
+
+  columns.resize(length);
+  scaled_row.resize(length);
+
+  for (int n = 0; n < length; n++)
   {
-    double u = 0.0;
+    columns[n] = ((sx0 - x0 + n) * step_x) >> 32;
+  }
+
+  const uint32_t *data = mipmap.data;
+  int64_t v = (sy0 - y0) * step_y;
+  int last_row = -1;
 
-    for (int x = 0; x < width; x++)
+  for (int y = sy0; y <= y1; y++)
+  {
+    int row = v >> 32;
+
+    // Scaling up repeats rows, which only have to be gathered once.
+    if (row != last_row)
     {
-      uint32_t color = picture.get_pixel(u, v);
+      const uint32_t *source = data + (row * w);
 
-      if (z == INT32_MIN)
-      {
-        draw_pixel(x0 + x, y0 + y, color);
-      }
-        else
+      for (int n = 0; n < length; n++)
       {
-        draw_pixel(x0 + x, y0 + y, color, z);
+        scaled_row[n] = source[columns[n]];
       }
 
-      u += scale_x;
+      last_row = row;
     }
 
-    v += scale_y;
+    copy_span(y, sx0, x1, scaled_row.data(), do_alpha_blending, z);
+
+    v += step_y;
   }
 }
 
@@ -1121,39 +906,86 @@ void Kohn3D::draw_picture_high_quality(
   int height,
   int z)
 {
-  int w = picture.get_width();
-  int h = picture.get_height();
+  if (width <= 0 || height <= 0) { return; }
+
+  flush();
+
+  int x1 = x0 + width - 1;
+  int y1 = y0 + height - 1;
+  int sx0 = x0, sy0 = y0;
+
+  if (!clip_rect(sx0, sy0, x1, y1)) { return; }
+
+  mark_dirty(sx0, sy0, x1, y1, z != INT32_MIN);
 
-  double scale_x = (double)w / (double)width;
-  double scale_y = (double)h / (double)height;
-  double v = 0.0;
+  // Only the visible part is scaled, but it's sampled relative to the
+  // whole picture so the result doesn't depend on the clip.
+  const int length = x1 - sx0 + 1;
 
-  for (int y = 0; y < height; y++)
+  scaled_picture.resize(length * (y1 - sy0 + 1));
+
+  // A summed area table costs the same per pixel however much the picture
+  // shrinks, while the resampler still filters every source row. A table
+  // lookup costs about 30 resampler taps, so it's only worth it when
+  // shrinking to under 1/32 of the area.
+  if (picture.has_summed_area_table() &&
+      resampler.get_filter() == Resampler::FILTER_AREA &&
+      width <= picture.get_width() &&
+      height <= picture.get_height() &&
+      (int64_t)width * height * 32 < (int64_t)picture.get_pixel_count())
   {
-    double u = 0.0;
+    double scale_x = (double)picture.get_width() / (double)width;
+    double scale_y = (double)picture.get_height() / (double)height;
+    uint32_t *pixel = scaled_picture.data();
 
-    for (int x = 0; x < width; x++)
+    for (int y = sy0 - y0; y <= y1 - y0; y++)
     {
-      uint32_t color = picture.get_scaled_pixel(u, v, scale_x, scale_y);
+      double v0 = y * scale_y;
+      double v1 = v0 + scale_y;
 
-      if (z == INT32_MIN)
-      {
-        draw_pixel(x0 + x, y0 + y, color);
-      }
-        else
+      for (int x = sx0 - x0; x <= x1 - x0; x++)
       {
-        draw_pixel(x0 + x, y0 + y, color, z);
-      }
+        double u0 = x * scale_x;
 
-      u += scale_x;
+        *pixel++ = picture.get_area_average(u0, v0, u0 + scale_x, v1);
+      }
     }
+  }
+    else
+  {
+    // Mipmaps leave less than a factor of 2 for the resampler to filter.
+    const Picture::Mipmap mipmap = picture.get_mipmap(width, height);
+
+    resampler.scale(
+      scaled_picture.data(),
+      mipmap.data,
+      mipmap.width,
+      mipmap.height,
+      width,
+      height,
+      sx0 - x0,
+      sy0 - y0,
+      x1 - x0,
+      y1 - y0,
+      worker_pool);
+  }
 
-    v += scale_y;
+  for (int y = sy0; y <= y1; y++)
+  {
+    copy_span(
+      y,
+      sx0,
+      x1,
+      scaled_picture.data() + ((y - sy0) * length),
+      do_alpha_blending,
+      z);
   }
 }
 
 void Kohn3D::write_frame()
 {
+  flush();
+
   image_writer->add_frame(picture, palette);
 }
 
@@ -1163,207 +995,847 @@ void Kohn3D::dump()
   printf("width=%d height=%d\n", width, height);
 }
 
-void Kohn3D::sort_vertexes(Triangle &triangle)
+bool Kohn3D::setup_triangle(Rasterizer &rasterizer, const DrawCommand &command)
+{
+  return rasterizer.setup(
+    command.fixed_x[0], command.fixed_y[0],
+    command.fixed_x[1], command.fixed_y[1],
+    command.fixed_x[2], command.fixed_y[2]);
+}
+
+void Kohn3D::set_render_threads(int count)
+{
+  flush();
+
+  if (worker_pool != nullptr)
+  {
+    delete worker_pool;
+    worker_pool = nullptr;
+  }
+
+  if (count <= 1) { return; }
+
+  worker_pool = new WorkerPool(count);
+
+  tile_columns = (width + TILE_SIZE - 1) / TILE_SIZE;
+  tile_rows = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+  tile_bins.resize(tile_columns * tile_rows);
+}
+
+void Kohn3D::set_scissor(int x0, int y0, int x1, int y1)
+{
+  if (x0 > x1) { exchange(x0, x1); }
+  if (y0 > y1) { exchange(y0, y1); }
+
+  clip_x0 = x0 < 0 ? 0 : x0;
+  clip_y0 = y0 < 0 ? 0 : y0;
+  clip_x1 = x1 >= width  ? width  - 1 : x1;
+  clip_y1 = y1 >= height ? height - 1 : y1;
+}
+
+void Kohn3D::mark_dirty_line(
+  int64_t x,
+  int64_t y,
+  int64_t step_x,
+  int64_t step_y,
+  int first,
+  int last,
+  bool has_z)
+{
+  // Lines are straight, so the ends give the bounding box.
+  int x0 = (x + (first * step_x)) >> 16;
+  int y0 = (y + (first * step_y)) >> 16;
+  int x1 = (x + (last * step_x)) >> 16;
+  int y1 = (y + (last * step_y)) >> 16;
+
+  if (x0 > x1) { exchange(x0, x1); }
+  if (y0 > y1) { exchange(y0, y1); }
+
+  mark_dirty(x0, y0, x1, y1, has_z);
+}
+
+bool Kohn3D::clip_rect(int &x0, int &y0, int &x1, int &y1)
+{
+  if (x0 > x1) { exchange(x0, x1); }
+  if (y0 > y1) { exchange(y0, y1); }
+
+  if (x0 < clip_x0) { x0 = clip_x0; }
+  if (y0 < clip_y0) { y0 = clip_y0; }
+  if (x1 > clip_x1) { x1 = clip_x1; }
+  if (y1 > clip_y1) { y1 = clip_y1; }
+
+  return x0 <= x1 && y0 <= y1;
+}
+
+int Kohn3D::get_outcode(int64_t x, int64_t y) const
+{
+  int code = 0;
+
+  if (x < clip_x0) { code |= 1; }
+  if (x > clip_x1) { code |= 2; }
+  if (y < clip_y0) { code |= 4; }
+  if (y > clip_y1) { code |= 8; }
+
+  return code;
+}
+
+bool Kohn3D::clip_line(
+  int64_t x,
+  int64_t y,
+  int64_t step_x,
+  int64_t step_y,
+  int steps,
+  int &first,
+  int &last) const
+{
+  first = 0;
+  last = steps;
+
+  int code0 = get_outcode(x >> 16, y >> 16);
+  int code1 = get_outcode((x + steps * step_x) >> 16, (y + steps * step_y) >> 16);
+
+  // Cohen-Sutherland trivial accept and reject.
+  if ((code0 | code1) == 0) { return true; }
+  if ((code0 & code1) != 0) { return false; }
+
+  // Otherwise find the range of steps that land inside the clip for
+  // each axis so the DDA can start and stop there.
+  if (!clip_steps(x, step_x, clip_x0, clip_x1, first, last)) { return false; }
+  if (!clip_steps(y, step_y, clip_y0, clip_y1, first, last)) { return false; }
+
+  return true;
+}
+
+void Kohn3D::fill_span(
+  int y,
+  int x0,
+  int x1,
+  uint32_t color,
+  bool alpha_blend)
+{
+  int pixel = (y * width) + x0;
+  int length = x1 - x0 + 1;
+
+  if (!is_32bit)
+  {
+    Span::fill(picture + pixel, length, color);
+  }
+    else
+  if (alpha_blend && (color >> 24) != 0xff)
+  {
+    Span::blend(picture_32bit + pixel, length, color);
+  }
+    else
+  {
+    Span::fill(picture_32bit + pixel, length, color);
+  }
+}
+
+void Kohn3D::fill_span(
+  int y,
+  int x0,
+  int x1,
+  uint32_t color,
+  bool alpha_blend,
+  int z)
 {
-  // Sort vertexes to y0 is top, y1 is middle, and y2 is bottom.
-  if (triangle.y0 > triangle.y1)
+  int pixel = (y * width) + x0;
+  int length = x1 - x0 + 1;
+
+  if (!is_32bit)
+  {
+    Span::fill(picture + pixel, z_buffer + pixel, length, color, z);
+  }
+    else
+  if (alpha_blend && (color >> 24) != 0xff)
+  {
+    Span::blend(picture_32bit + pixel, z_buffer + pixel, length, color, z);
+  }
+    else
+  {
+    Span::fill(picture_32bit + pixel, z_buffer + pixel, length, color, z);
+  }
+}
+
+void Kohn3D::copy_span(
+  int y,
+  int x0,
+  int x1,
+  const uint32_t *source,
+  bool alpha_blend,
+  int z)
+{
+  int pixel = (y * width) + x0;
+  int length = x1 - x0 + 1;
+
+  if (z == INT32_MIN)
+  {
+    if (!is_32bit)
+    {
+      Span::copy(picture + pixel, source, length);
+    }
+      else
+    if (alpha_blend)
+    {
+      Span::blend(picture_32bit + pixel, source, length);
+    }
+      else
+    {
+      Span::copy(picture_32bit + pixel, source, length);
+    }
+  }
+    else
   {
-    exchange(triangle.x0, triangle.x1);
-    exchange(triangle.y0, triangle.y1);
-    exchange(triangle.z0, triangle.z1);
+    if (!is_32bit)
+    {
+      Span::copy(picture + pixel, z_buffer + pixel, source, length, z);
+    }
+      else
+    if (alpha_blend)
+    {
+      Span::blend(picture_32bit + pixel, z_buffer + pixel, source, length, z);
+    }
+      else
+    {
+      Span::copy(picture_32bit + pixel, z_buffer + pixel, source, length, z);
+    }
   }
+}
 
-  if (triangle.y1 > triangle.y2)
+void Kohn3D::submit(DrawCommand &command)
+{
+  Rasterizer rasterizer;
+  rasterizer.set_clip(clip_x0, clip_y0, clip_x1, clip_y1);
+  rasterizer.set_cull_mode(cull_mode);
+
+  if (!setup_triangle(rasterizer, command)) { return; }
+
+  mark_dirty(
+    rasterizer.get_x_start(),
+    rasterizer.get_y_start(),
+    rasterizer.get_x_end(),
+    rasterizer.get_y_end(),
+    command.type != DrawCommand::FLAT);
+
+  command.alpha_blend = do_alpha_blending;
+  command.x0 = rasterizer.get_x_start();
+  command.y0 = rasterizer.get_y_start();
+  command.x1 = rasterizer.get_x_end();
+  command.y1 = rasterizer.get_y_end();
+
+  if (!is_recording())
   {
-    exchange(triangle.x1, triangle.x2);
-    exchange(triangle.y1, triangle.y2);
-    exchange(triangle.z1, triangle.z2);
+    rasterize(command, rasterizer);
+    return;
   }
 
-  if (triangle.y0 > triangle.y1)
+  // Triangles recorded before this one can only make it more hidden, so
+  // if it's already hidden it never has to be recorded.
+  if (command.type != DrawCommand::FLAT &&
+      is_occluded(rasterizer, get_z_max(command.v)))
   {
-    exchange(triangle.x0, triangle.x1);
-    exchange(triangle.y0, triangle.y1);
-    exchange(triangle.z0, triangle.z1);
+    return;
   }
+
+  command.depth = get_z_max(command.v);
+
+  commands.push_back(command);
 }
 
-void Kohn3D::sort_vertexes(Triangle &triangle, uint32_t *colors)
+void Kohn3D::record(const DrawCommand &command)
 {
-  // Sort vertexes to y0 is top, y1 is middle, and y2 is bottom.
-  if (triangle.y0 > triangle.y1)
+  if (is_recording())
   {
-    exchange(triangle.x0, triangle.x1);
-    exchange(triangle.y0, triangle.y1);
-    exchange(triangle.z0, triangle.z1);
-    exchange(colors[0], colors[1]);
+    commands.push_back(command);
   }
+    else
+  {
+    rasterize(command, command.x0, command.y0, command.x1, command.y1);
+  }
+}
+
+void Kohn3D::sort_commands()
+{
+  int count = commands.size();
+  int start = 0;
 
-  if (triangle.y1 > triangle.y2)
+  // Anything that isn't sortable splits the list, so nothing is moved
+  // past something whose result depends on the order.
+  while (start < count)
   {
-    exchange(triangle.x1, triangle.x2);
-    exchange(triangle.y1, triangle.y2);
-    exchange(triangle.z1, triangle.z2);
-    exchange(colors[1], colors[2]);
+    if (!commands[start].is_sortable()) { start++; continue; }
+
+    int end = start + 1;
+
+    while (end < count && commands[end].is_sortable()) { end++; }
+
+    // Nearest first (larger z is nearer) so hierarchical Z rejects as
+    // much of the rest as possible.
+    std::stable_sort(
+      commands.begin() + start,
+      commands.begin() + end,
+      [](const DrawCommand &a, const DrawCommand &b)
+      {
+        return a.depth > b.depth;
+      });
+
+    start = end;
   }
 
-  if (triangle.y0 > triangle.y1)
+  // Merge rects that share a whole edge. They don't overlap, so this
+  // works with alpha blending too.
+  int last = 0;
+
+  for (int n = 1; n < count; n++)
   {
-    exchange(triangle.x0, triangle.x1);
-    exchange(triangle.y0, triangle.y1);
-    exchange(triangle.z0, triangle.z1);
-    exchange(colors[0], colors[1]);
+    DrawCommand &a = commands[last];
+    const DrawCommand &b = commands[n];
+
+    bool is_same =
+      (a.type == DrawCommand::RECT || a.type == DrawCommand::RECT_DEPTH) &&
+      a.type == b.type &&
+      a.color == b.color &&
+      a.depth == b.depth &&
+      a.alpha_blend == b.alpha_blend;
+
+    if (is_same && a.x0 == b.x0 && a.x1 == b.x1 && a.y1 + 1 == b.y0)
+    {
+      a.y1 = b.y1;
+    }
+      else
+    if (is_same && a.y0 == b.y0 && a.y1 == b.y1 && a.x1 + 1 == b.x0)
+    {
+      a.x1 = b.x1;
+    }
+      else
+    {
+      commands[++last] = b;
+    }
   }
+
+  if (count != 0) { commands.resize(last + 1); }
 }
 
-void Kohn3D::sort_vertexes(Triangle &triangle, Texture &texture)
+void Kohn3D::draw_commands()
 {
-  texture.reset_sort();
+  if (is_deferred) { sort_commands(); }
+
+  int count = commands.size();
 
-  // Sort vertexes to y0 is top, y1 is middle, and y2 is bottom.
-  if (triangle.y0 > triangle.y1)
+  if (worker_pool == nullptr)
   {
-    exchange(triangle.x0, triangle.x1);
-    exchange(triangle.y0, triangle.y1);
-    exchange(triangle.z0, triangle.z1);
-    texture.exchange(0, 1);
+    for (int n = 0; n < count; n++)
+    {
+      const DrawCommand &command = commands[n];
+
+      rasterize(command, command.x0, command.y0, command.x1, command.y1);
+    }
+
+    // The capacity is kept so following frames don't allocate.
+    commands.clear();
+
+    return;
   }
 
-  if (triangle.y1 > triangle.y2)
+  for (auto &bin : tile_bins) { bin.clear(); }
+
+  // Bin each command into every tile its bounding box touches. The
+  // bins keep the order commands were drawn in.
+  for (int n = 0; n < count; n++)
   {
-    exchange(triangle.x1, triangle.x2);
-    exchange(triangle.y1, triangle.y2);
-    exchange(triangle.z1, triangle.z2);
-    texture.exchange(1, 2);
+    const DrawCommand &command = commands[n];
+
+    int tx0 = command.x0 / TILE_SIZE;
+    int ty0 = command.y0 / TILE_SIZE;
+    int tx1 = command.x1 / TILE_SIZE;
+    int ty1 = command.y1 / TILE_SIZE;
+
+    for (int ty = ty0; ty <= ty1; ty++)
+    {
+      for (int tx = tx0; tx <= tx1; tx++)
+      {
+        tile_bins[(ty * tile_columns) + tx].push_back(n);
+      }
+    }
   }
 
-  if (triangle.y0 > triangle.y1)
+  worker_pool->run(tile_bins.size(), [this](int index) { draw_tile(index); });
+
+  commands.clear();
+}
+
+void Kohn3D::draw_tile(int index)
+{
+  const std::vector<int> &bin = tile_bins[index];
+
+  int x0 = (index % tile_columns) * TILE_SIZE;
+  int y0 = (index / tile_columns) * TILE_SIZE;
+  int x1 = x0 + TILE_SIZE - 1;
+  int y1 = y0 + TILE_SIZE - 1;
+
+  if (x1 >= width)  { x1 = width - 1; }
+  if (y1 >= height) { y1 = height - 1; }
+
+  for (int n : bin)
   {
-    exchange(triangle.x0, triangle.x1);
-    exchange(triangle.y0, triangle.y1);
-    exchange(triangle.z0, triangle.z1);
-    texture.exchange(0, 1);
+    rasterize(commands[n], x0, y0, x1, y1);
   }
 }
 
-void Kohn3D::rotate(Triangle &triangle, const Rotation &rotation)
+void Kohn3D::rasterize(
+  const DrawCommand &command,
+  int x0,
+  int y0,
+  int x1,
+  int y1)
 {
-  rotate(triangle.x0, triangle.y0, triangle.z0, rotation);
-  rotate(triangle.x1, triangle.y1, triangle.z1, rotation);
-  rotate(triangle.x2, triangle.y2, triangle.z2, rotation);
+  // Recorded commands were already culled and clipped to the scissor
+  // in effect when they were drawn.
+  if (x0 < command.x0) { x0 = command.x0; }
+  if (y0 < command.y0) { y0 = command.y0; }
+  if (x1 > command.x1) { x1 = command.x1; }
+  if (y1 > command.y1) { y1 = command.y1; }
+
+  if (command.type == DrawCommand::RECT)
+  {
+    for (int y = y0; y <= y1; y++)
+    {
+      fill_span(y, x0, x1, command.color, command.alpha_blend);
+    }
+
+    return;
+  }
+
+  if (command.type == DrawCommand::RECT_DEPTH)
+  {
+    if (is_occluded(x0, y0, x1, y1, command.depth)) { return; }
+
+    for (int y = y0; y <= y1; y++)
+    {
+      fill_span(y, x0, x1, command.color, command.alpha_blend, command.depth);
+    }
+
+    update_z_blocks(x0, y0, x1, y1, command.depth);
+
+    return;
+  }
+
+  Rasterizer rasterizer;
+  rasterizer.set_clip(x0, y0, x1, y1);
+
+  if (!setup_triangle(rasterizer, command)) { return; }
+
+  rasterize(command, rasterizer);
 }
 
-void Kohn3D::rotate(int &x, int &y, int &z, const Rotation &rotation)
+void Kohn3D::rasterize(
+  const DrawCommand &command,
+  Rasterizer &rasterizer)
 {
-  float t;
-  float s, c;
+  if (command.type == DrawCommand::FLAT)
+  {
+    rasterize_flat(command, rasterizer);
+    return;
+  }
+
+  if (is_occluded(rasterizer, get_z_max(command.v))) { return; }
 
-  // [     1       0         0   ]   [ x ]
-  // [     0   cos(rx)  -sin(ry) ] * [ y ]
-  // [     0   sin(rx)   cos(ry) ]   [ z ]
-  if (rotation.rx != 0)
+  switch (command.type)
   {
-    c = cos(rotation.rx);
-    s = sin(rotation.rx);
+    case DrawCommand::DEPTH:
+      rasterize_depth(command, rasterizer);
+      break;
+    case DrawCommand::COLORS:
+      rasterize_colors(command, rasterizer);
+      break;
+    case DrawCommand::TEXTURE:
+      rasterize_texture(command, rasterizer);
+      break;
+    default:
+      break;
+  }
+
+  update_z_blocks(rasterizer, get_z_min(command.v));
+}
+
+void Kohn3D::rasterize_flat(
+  const DrawCommand &command,
+  Rasterizer &rasterizer)
+{
+  for (int y = rasterizer.get_y_start(); y <= rasterizer.get_y_end(); y++)
+  {
+    int x0, x1;
 
-    t = (y * c) - (z * s);
-    z = (y * s) + (z * c);
-    y = t;
+    if (!rasterizer.get_span(y, x0, x1)) { continue; }
+
+    fill_span(y, x0, x1, command.color, command.alpha_blend);
   }
+}
 
-  // [ cos(ry)     0     sin(ry) ]   [ x ]
-  // [      0      1         0   ] * [ y ]
-  // [ -sin(ry)    0     cos(ry) ]   [ z ]
-  if (rotation.ry != 0)
+void Kohn3D::rasterize_depth(
+  const DrawCommand &command,
+  Rasterizer &rasterizer)
+{
+  const Triangle &v = command.v;
+
+  Rasterizer::Gradient gradient_z;
+  rasterizer.compute_gradient(gradient_z, v.z0, v.z1, v.z2);
+
+  // Depth is stepped across each span in 16.16 fixed point starting from
+  // the left edge of the command's clipped area, which is the same for
+  // every tile, so tiles don't change the result.
+  const int64_t dz = gradient_z.get_fixed_dx_64();
+  const int x_reference = command.x0;
+
+  for (int y = rasterizer.get_y_start(); y <= rasterizer.get_y_end(); y++)
   {
-    c = cos(rotation.ry);
-    s = sin(rotation.ry);
+    int x0, x1;
 
-    t =  (x * c) + (z * s);
-    z = -(x * s) + (z * c);
-    x = t;
+    if (!rasterizer.get_span(y, x0, x1)) { continue; }
+
+    int pixel = (y * width) + x0;
+    int64_t z = gradient_z.get_fixed_64(x_reference, x0, y);
+
+    for (int x = x0; x <= x1; x++)
+    {
+      put_pixel(pixel++, command.color, command.alpha_blend, z >> 16);
+      z += dz;
+    }
   }
+}
 
-  // [ cos(rz) -sin(rz)      0   ]   [ x ]
-  // [ sin(rz)  cos(rz)      0   ] * [ y ]
-  // [     0       0         1   ]   [ z ]
-  if (rotation.rz != 0)
+void Kohn3D::rasterize_colors(
+  const DrawCommand &command,
+  Rasterizer &rasterizer)
+{
+  const Triangle &v = command.v;
+
+  int a0, r0, g0, b0;
+  int a1, r1, g1, b1;
+  int a2, r2, g2, b2;
+
+  split_rgb(command.colors[0], a0, r0, g0, b0);
+  split_rgb(command.colors[1], a1, r1, g1, b1);
+  split_rgb(command.colors[2], a2, r2, g2, b2);
+
+  Rasterizer::Gradient gradient_z;
+  Rasterizer::Gradient gradient_a;
+  Rasterizer::Gradient gradient_r;
+  Rasterizer::Gradient gradient_g;
+  Rasterizer::Gradient gradient_b;
+
+  rasterizer.compute_gradient(gradient_z, v.z0, v.z1, v.z2);
+  rasterizer.compute_gradient(gradient_a, a0, a1, a2);
+  rasterizer.compute_gradient(gradient_r, r0, r1, r2);
+  rasterizer.compute_gradient(gradient_g, g0, g1, g2);
+  rasterizer.compute_gradient(gradient_b, b0, b1, b2);
+
+  const int64_t dz = gradient_z.get_fixed_dx_64();
+  const int32_t da = gradient_a.get_fixed_dx();
+  const int32_t dr = gradient_r.get_fixed_dx();
+  const int32_t dg = gradient_g.get_fixed_dx();
+  const int32_t db = gradient_b.get_fixed_dx();
+  const int x_reference = command.x0;
+
+  PackedColor color;
+  color.set_step(da, dr, dg, db);
+
+  for (int y = rasterizer.get_y_start(); y <= rasterizer.get_y_end(); y++)
   {
-    c = cos(rotation.rz);
-    s = sin(rotation.rz);
+    int x0, x1;
+
+    if (!rasterizer.get_span(y, x0, x1)) { continue; }
+
+    int pixel = (y * width) + x0;
+    int64_t z = gradient_z.get_fixed_64(x_reference, x0, y);
 
-    t = (x * c) - (y * s);
-    y = (x * s) + (y * c);
-    x = t;
+    color.set(
+      Rasterizer::clamp_fixed_16(gradient_a.get_fixed_64(x_reference, x0, y)),
+      Rasterizer::clamp_fixed_16(gradient_r.get_fixed_64(x_reference, x0, y)),
+      Rasterizer::clamp_fixed_16(gradient_g.get_fixed_64(x_reference, x0, y)),
+      Rasterizer::clamp_fixed_16(gradient_b.get_fixed_64(x_reference, x0, y)));
+
+    for (int x = x0; x <= x1; x++)
+    {
+      put_pixel(pixel++, color.get(), command.alpha_blend, z >> 16);
+
+      z += dz;
+      color.step();
+    }
   }
 }
 
-void Kohn3D::translation(Triangle &triangle, int x, int y, int z)
+void Kohn3D::rasterize_texture(
+  const DrawCommand &command,
+  Rasterizer &rasterizer)
 {
-  triangle.x0 += x;
-  triangle.y0 += y;
-  triangle.z0 += z;
-  triangle.x1 += x;
-  triangle.y1 += y;
-  triangle.z1 += z;
-  triangle.x2 += x;
-  triangle.y2 += y;
-  triangle.z2 += z;
+  const Triangle &v = command.v;
+  const Texture &texture = *command.texture;
+  const int z_max = get_z_max(v);
+
+  Rasterizer::Gradient gradient_z;
+  Rasterizer::Gradient gradient_u;
+  Rasterizer::Gradient gradient_v;
+  Rasterizer::Gradient gradient_q;
+
+  const float *u = command.texture_u;
+  const float *t = command.texture_v;
+  const float *q = command.texture_q;
+
+  rasterizer.compute_gradient(gradient_z, v.z0, v.z1, v.z2);
+  rasterizer.compute_gradient(gradient_u, u[0], u[1], u[2]);
+  rasterizer.compute_gradient(gradient_v, t[0], t[1], t[2]);
+  rasterizer.compute_gradient(gradient_q, q[0], q[1], q[2]);
+
+  const int64_t dz = gradient_z.get_fixed_dx_64();
+  const int x_reference = command.x0;
+
+  for (int y = rasterizer.get_y_start(); y <= rasterizer.get_y_end(); y++)
+  {
+    int x0, x1;
+
+    if (!rasterizer.get_span(y, x0, x1)) { continue; }
+
+    int pixel = (y * width) + x0;
+    int64_t z0 = gradient_z.get_fixed_64(x_reference, x0, y);
+    int x = x0;
+
+    // Work a block at a time so texels are never looked up for parts of
+    // the span that are hidden. u and v are divided by q exactly at each
+    // block edge and stepped linearly between them. Block edges don't
+    // move when the span is clipped to a tile, so neither does the result.
+    while (x <= x1)
+    {
+      int next = (x | (Z_BLOCK_SIZE - 1)) + 1;
+      int end = next <= x1 ? next - 1 : x1;
+      int count = end - x + 1;
+
+      if (is_occluded(x, y, end, y, z_max))
+      {
+        pixel += count;
+        z0 += count * dz;
+        x = next;
+        continue;
+      }
+
+      const double q0 = gradient_q.get(x, y);
+      const double q1 = gradient_q.get(next, y);
+      const double u0 = gradient_u.get(x, y) / q0;
+      const double v0 = gradient_v.get(x, y) / q0;
+      const double u1 = gradient_u.get(next, y) / q1;
+      const double v1 = gradient_v.get(next, y) / q1;
+
+      int32_t texel_u = Rasterizer::to_fixed_16(u0);
+      int32_t texel_v = Rasterizer::to_fixed_16(v0);
+      const int32_t du = Rasterizer::to_fixed_16((u1 - u0) / (next - x));
+      const int32_t dv = Rasterizer::to_fixed_16((v1 - v0) / (next - x));
+
+      for (; x <= end; x++)
+      {
+        int z = z0 >> 16;
+
+        z0 += dz;
+
+        if (z >= z_buffer[pixel])
+        {
+          uint32_t color = texture.get_texel(texel_u, texel_v);
+
+          put_pixel(pixel, color, command.alpha_blend);
+          z_buffer[pixel] = z;
+        }
+
+        pixel++;
+        texel_u += du;
+        texel_v += dv;
+      }
+    }
+  }
 }
 
-void Kohn3D::projection(Triangle &triangle)
+void Kohn3D::transform_mesh(const Mesh &mesh, const Transform &transform)
 {
-  // Weak perspective projection.
-  //const double scale = -16738.0;
-  const double scale = -1024.0;
+  int count = mesh.get_vertex_count();
 
-  if (triangle.z0 != 0)
+  // The cache is kept between draws so it only allocates when a bigger
+  // mesh comes along.
+  mesh_vertexes.resize(count);
+
+  for (int n = 0; n < count; n++)
   {
-    double z = triangle.z0 + scale;
-    triangle.x0 = scale * ((double)triangle.x0 / z);
-    triangle.y0 = scale * ((double)triangle.y0 / z);
+    const Mesh::Vertex &vertex = mesh.get_vertex(n);
+
+    double x = vertex.x;
+    double y = vertex.y;
+    double z = vertex.z;
+    double w;
+
+    transform.apply(x, y, z, w);
+
+    mesh_vertexes[n].x = Rasterizer::to_fixed(x);
+    mesh_vertexes[n].y = Rasterizer::to_fixed(y);
+    mesh_vertexes[n].z = z;
+    mesh_vertexes[n].color = vertex.color;
   }
+}
 
-  if (triangle.z1 != 0)
+void Kohn3D::submit_mesh(
+  const Mesh &mesh,
+  DrawCommand::Type type,
+  uint32_t color,
+  const uint32_t *triangle_colors)
+{
+  int count = mesh.get_triangle_count();
+
+  for (int n = 0; n < count; n++)
   {
-    double z = triangle.z1 + scale;
-    triangle.x1 = scale * ((double)triangle.x1 / z);
-    triangle.y1 = scale * ((double)triangle.y1 / z);
+    int i0, i1, i2;
+
+    mesh.get_triangle(n, i0, i1, i2);
+
+    const ScreenVertex &v0 = mesh_vertexes[i0];
+    const ScreenVertex &v1 = mesh_vertexes[i1];
+    const ScreenVertex &v2 = mesh_vertexes[i2];
+
+    DrawCommand command;
+
+    command.type = type;
+    command.v.set_vertex_0(
+      v0.x / Rasterizer::SUBPIXEL_ONE, v0.y / Rasterizer::SUBPIXEL_ONE, v0.z);
+    command.v.set_vertex_1(
+      v1.x / Rasterizer::SUBPIXEL_ONE, v1.y / Rasterizer::SUBPIXEL_ONE, v1.z);
+    command.v.set_vertex_2(
+      v2.x / Rasterizer::SUBPIXEL_ONE, v2.y / Rasterizer::SUBPIXEL_ONE, v2.z);
+    command.fixed_x[0] = v0.x;
+    command.fixed_y[0] = v0.y;
+    command.fixed_x[1] = v1.x;
+    command.fixed_y[1] = v1.y;
+    command.fixed_x[2] = v2.x;
+    command.fixed_y[2] = v2.y;
+    command.color = triangle_colors != nullptr ? triangle_colors[n] : color;
+    command.colors[0] = v0.color;
+    command.colors[1] = v1.color;
+    command.colors[2] = v2.color;
+
+    submit(command);
   }
+}
+
+bool Kohn3D::is_occluded(int x0, int y0, int x1, int y1, int z_max)
+{
+  // Interpolated depth can come out 1 past the vertexes from rounding.
+  z_max++;
 
-  if (triangle.z2 != 0)
+  if (z_max >= 32767) { return false; }
+
+  int bx0 = x0 / Z_BLOCK_SIZE;
+  int by0 = y0 / Z_BLOCK_SIZE;
+  int bx1 = x1 / Z_BLOCK_SIZE;
+  int by1 = y1 / Z_BLOCK_SIZE;
+
+  for (int by = by0; by <= by1; by++)
   {
-    double z = triangle.z2 + scale;
-    triangle.x2 = scale * ((double)triangle.x2 / z);
-    triangle.y2 = scale * ((double)triangle.y2 / z);
+    const int16_t *block = z_blocks + (by * z_block_columns);
+
+    for (int bx = bx0; bx <= bx1; bx++)
+    {
+      if (z_max >= block[bx]) { return false; }
+    }
   }
+
+  return true;
 }
 
-uint32_t Kohn3D::calculate_alpha(uint32_t color, int pixel)
+bool Kohn3D::is_occluded(const Rasterizer &rasterizer, int z_max)
 {
-  int level = color >> 24;
-  if (level == 0) { return picture_32bit[pixel]; }
-  if (level == 0xff) { return color; }
+  return is_occluded(
+    rasterizer.get_x_start(),
+    rasterizer.get_y_start(),
+    rasterizer.get_x_end(),
+    rasterizer.get_y_end(),
+    z_max);
+}
 
-  uint32_t old = picture_32bit[pixel];
-  float color_fract = (float)level / 255.0f;
-  float old_fract = (float)(0xff - level) / 255.0f;
+void Kohn3D::update_z_blocks(int x0, int y0, int x1, int y1, int z)
+{
+  if (z <= -32767 || z > 32767) { return; }
 
-  int old_r = ((old >> 16) & 0xff);
-  int old_g = ((old >> 8) & 0xff);
-  int old_b = (old & 0xff);
-  int color_r = ((color >> 16) & 0xff);
-  int color_g = ((color >> 8) & 0xff);
-  int color_b = (color & 0xff);
+  // Only blocks that are completely inside the rectangle.
+  int bx0 = (x0 + Z_BLOCK_SIZE - 1) / Z_BLOCK_SIZE;
+  int by0 = (y0 + Z_BLOCK_SIZE - 1) / Z_BLOCK_SIZE;
+  int bx1 = ((x1 + 1) / Z_BLOCK_SIZE) - 1;
+  int by1 = ((y1 + 1) / Z_BLOCK_SIZE) - 1;
 
-  color_r = (color_r * color_fract) + (old_r * old_fract);
-  color_g = (color_g * color_fract) + (old_g * old_fract);
-  color_b = (color_b * color_fract) + (old_b * old_fract);
+  for (int by = by0; by <= by1; by++)
+  {
+    int16_t *block = z_blocks + (by * z_block_columns);
 
-  if (color_r > 255) { color_r = 255; }
-  if (color_g > 255) { color_g = 255; }
-  if (color_b > 255) { color_b = 255; }
+    for (int bx = bx0; bx <= bx1; bx++)
+    {
+      if (block[bx] < z) { block[bx] = z; }
+    }
+  }
+}
+
+void Kohn3D::update_z_blocks(const Rasterizer &rasterizer, int z_min)
+{
+  // Interpolated depth can come out 1 under the vertexes from rounding.
+  z_min--;
+
+  int by0 = (rasterizer.get_y_start() + Z_BLOCK_SIZE - 1) / Z_BLOCK_SIZE;
+  int by1 = ((rasterizer.get_y_end() + 1) / Z_BLOCK_SIZE) - 1;
+
+  // The triangle is convex, so a block is covered if the spans on its
+  // top and bottom rows both cover it.
+  for (int by = by0; by <= by1; by++)
+  {
+    int y = by * Z_BLOCK_SIZE;
+    int top0, top1, bottom0, bottom1;
+
+    if (!rasterizer.get_span(y, top0, top1)) { continue; }
+    if (!rasterizer.get_span(y + Z_BLOCK_SIZE - 1, bottom0, bottom1)) { continue; }
+
+    int x0 = top0 > bottom0 ? top0 : bottom0;
+    int x1 = top1 < bottom1 ? top1 : bottom1;
+
+    update_z_blocks(x0, y, x1, y + Z_BLOCK_SIZE - 1, z_min);
+  }
+}
+
+void Kohn3D::translation(DrawCommand &command, int x, int y, int z)
+{
+  Triangle &triangle = command.v;
+
+  triangle.x0 += x;
+  triangle.y0 += y;
+  triangle.z0 += z;
+  triangle.x1 += x;
+  triangle.y1 += y;
+  triangle.z1 += z;
+  triangle.x2 += x;
+  triangle.y2 += y;
+  triangle.z2 += z;
 
-  return (color_r << 16) | (color_g << 8) | color_b;
+  command.fixed_x[0] = Rasterizer::to_fixed(triangle.x0);
+  command.fixed_y[0] = Rasterizer::to_fixed(triangle.y0);
+  command.fixed_x[1] = Rasterizer::to_fixed(triangle.x1);
+  command.fixed_y[1] = Rasterizer::to_fixed(triangle.y1);
+  command.fixed_x[2] = Rasterizer::to_fixed(triangle.x2);
+  command.fixed_y[2] = Rasterizer::to_fixed(triangle.y2);
+}
+
+void Kohn3D::apply_transform(
+  DrawCommand &command,
+  const Transform &transform,
+  double w[])
+{
+  Triangle &t = command.v;
+
+  transform_vertex(
+    transform, t.x0, t.y0, t.z0, command.fixed_x[0], command.fixed_y[0], w[0]);
+  transform_vertex(
+    transform, t.x1, t.y1, t.z1, command.fixed_x[1], command.fixed_y[1], w[1]);
+  transform_vertex(
+    transform, t.x2, t.y2, t.z2, command.fixed_x[2], command.fixed_y[2], w[2]);
 }
 
@@ -16,12 +16,20 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include <vector>
+
 #include "ImageWriterBmp.h"
 #include "ImageWriterGif.h"
 #include "ImageWriterAvi.h"
+#include "Mesh.h"
 #include "Picture.h"
 #include "PolarCoords.h"
+#include "Rasterizer.h"
+#include "Resampler.h"
+#include "Span.h"
 #include "Texture.h"
+#include "Transform.h"
+#include "WorkerPool.h"
 
 class Kohn3D
 {
@@ -66,71 +74,140 @@ public:
 
   static const int LOOP_INFINITE = 0;
   void set_loop_count(int value) { image_writer->set_loop_count(value); }
-  void set_32bit() { is_32bit = true; }
 
-  void init_end();
-  uint8_t *get_picture() { return picture; }
-  uint32_t *get_picture_32bit() { return picture_32bit; }
-  void clear();
+  // GIF only, see ImageWriterGif.h. Ignored for the other formats.
+  void enable_delta_frames(bool value)
+  {
+    if (image_writer_gif != nullptr) { image_writer_gif->enable_delta_frames(value); }
+  }
 
-  void enable_alpha_blending(bool value) { do_alpha_blending = value; }
+  void enable_delta_transparency(bool value)
+  {
+    if (image_writer_gif != nullptr) { image_writer_gif->enable_delta_transparency(value); }
+  }
 
-  void draw_pixel(int x, int y, uint32_t color)
+  void set_encode_threads(int count, int queue_depth = 0)
   {
-    if (x < 0 || x >= width) { return; }
-    if (y < 0 || y >= height) { return; }
+    if (image_writer_gif != nullptr)
+    {
+      image_writer_gif->set_encode_threads(count, queue_depth);
+    }
+  }
 
-    int pixel = (y * width) + x;
+  void set_encode_strips(int count)
+  {
+    if (image_writer_gif != nullptr) { image_writer_gif->set_encode_strips(count); }
+  }
 
-    if (is_32bit)
-    {
-      if (do_alpha_blending) { color = calculate_alpha(color, pixel); }
+  void set_32bit() { is_32bit = true; }
 
-      picture_32bit[pixel] = color;
-    }
-      else
-    {
-      picture[pixel] = color;
-    }
+  void init_end();
+
+  // The caller could write anywhere in the picture, so all of it will be
+  // cleared on the next clear().
+  uint8_t *get_picture()
+  {
+    flush();
+    dirty.add(0, 0, width - 1, height - 1);
+    return picture;
   }
 
-  void draw_pixel(const PolarCoords &coords, uint32_t color)
+  uint32_t *get_picture_32bit()
   {
-    int x, y;
+    flush();
+    dirty.add(0, 0, width - 1, height - 1);
+    return picture_32bit;
+  }
 
-    coords.to_xy_centered(x, y);
+  // Only the area drawn since the last clear() is reset.
+  void clear();
 
-    draw_pixel(x, y, color);
+  // Color index for 8 bit pictures, ARGB for 32 bit. Default is 0.
+  void set_clear_color(uint32_t value);
+
+  // With more than 1 thread, triangles are recorded and then drawn in
+  // TILE_SIZE x TILE_SIZE tiles across a pool of threads when the frame
+  // is written (or any other draw call needs the picture).
+  static const int TILE_SIZE = 64;
+  void set_render_threads(int count);
+  void flush() { if (commands.size() != 0) { draw_commands(); } }
+
+  // Draw calls are recorded instead of drawn until the next flush(). Runs
+  // of opaque depth tested triangles and rects are then sorted front to
+  // back and touching rects are merged. Horizontal 2D lines are recorded
+  // as rects, so they can be merged too. Other lines, pixels and pictures
+  // still draw immediately (after a flush). Where two primitives have
+  // exactly the same depth at a pixel the sorted order decides which one
+  // shows.
+  void set_deferred(bool value) { flush(); is_deferred = value; }
+
+  void enable_alpha_blending(bool value) { do_alpha_blending = value; }
+
+  // Textured triangles map the texture's set_coords() to their vertexes.
+  // By default u and v are interpolated linearly on screen. With this on
+  // they are corrected for the projection using 1 / w.
+  void enable_perspective_correction(bool value)
+  {
+    do_perspective_correction = value;
   }
 
-  void draw_pixel(int x, int y, uint32_t color, int z)
+  // Polar coordinates are converted with FastMath instead of libm. See
+  // FastMath.h for how accurate it is.
+  void enable_fast_math(bool value) { do_fast_math = value; }
+
+  // Off by default. Triangles are culled by their winding on screen after
+  // projection, so closed meshes should wind every face the same way.
+  void set_cull_mode(Rasterizer::CullMode value) { cull_mode = value; }
+
+  // Filter used by draw_picture_high_quality(), FILTER_AREA by default.
+  void set_resample_filter(Resampler::Filter value) { resampler.set_filter(value); }
+
+  // Drawing is limited to this inclusive rectangle, which is clipped to
+  // the picture. Primitives are clipped once when they are set up.
+  void set_scissor(int x0, int y0, int x1, int y1);
+  void reset_scissor() { set_scissor(0, 0, width - 1, height - 1); }
+
+  void draw_pixel(int x, int y, uint32_t color)
   {
-    if (x < 0 || x >= width) { return; }
-    if (y < 0 || y >= height) { return; }
+    if (x < clip_x0 || x > clip_x1) { return; }
+    if (y < clip_y0 || y > clip_y1) { return; }
 
-    int pixel = (y * width) + x;
+    flush();
+    mark_dirty(x, y, x, y, false);
+    put_pixel((y * width) + x, color, do_alpha_blending);
+  }
 
-    if (z < z_buffer[pixel]) { return; }
+  void draw_pixel(const PolarCoords &coords, uint32_t color)
+  {
+    int x, y;
 
-    if (is_32bit)
+    if (do_fast_math)
     {
-      if (do_alpha_blending) { color = calculate_alpha(color, pixel); }
-
-      picture_32bit[pixel] = color;
+      coords.to_xy_centered_fast(x, y);
     }
       else
     {
-      picture[pixel] = color;
+      coords.to_xy_centered(x, y);
     }
 
-    z_buffer[pixel] = z;
+    draw_pixel(x, y, color);
+  }
+
+  void draw_pixel(int x, int y, uint32_t color, int z)
+  {
+    if (x < clip_x0 || x > clip_x1) { return; }
+    if (y < clip_y0 || y > clip_y1) { return; }
+
+    flush();
+    mark_dirty(x, y, x, y, true);
+    put_pixel((y * width) + x, color, do_alpha_blending, z);
   }
 
   void draw_line(int x0, int y0, int x1, int y1, uint32_t color);
   void draw_line(const PolarCoords &coords, uint32_t color);
   void draw_line(int x0, int y0, int z0, int x1, int y1, int z1, uint32_t color);
   void draw_line(int x0, int y0, int z0, int x1, int y1, int z1, Texture &texture, int center_x, int center_y);
-  void draw_line(int x0, int y0, int z0, int x1, int y1, int z1, int a0, int r0, int g0, int b0, int a1, int r1, int b1, int g1);
+  void draw_line(int x0, int y0, int z0, int x1, int y1, int z1, int a0, int r0, int g0, int b0, int a1, int r1, int g1, int b1);
 
   void draw_rect(int x0, int y0, int x1, int y1, uint32_t color);
   void draw_rect(int x0, int y0, int x1, int y1, uint32_t color, int z);
@@ -174,6 +251,13 @@ public:
   void load_triangle(Triangle &triangle, const int coords[]);
   void load_rotation(Rotation &rotation, const float values[]);
 
+  // Rotation, then translation, then the same projection the draw
+  // functions that take a Rotation use.
+  static void load_transform(
+    Transform &transform,
+    const Rotation &rotation,
+    int x, int y, int z);
+
   void draw_triangle(const Triangle &triangle, int x, int y, uint32_t color);
   void draw_triangle(const Triangle &triangle, int x, int y, int z, uint32_t color);
   void draw_triangle(const Triangle &triangle, int x, int y, int z, uint32_t *colors);
@@ -197,6 +281,34 @@ public:
     int x, int y, int z,
     Texture &texture);
 
+  void draw_triangle(const Triangle &triangle, const Transform &transform, uint32_t color);
+  void draw_triangle(const Triangle &triangle, const Transform &transform, uint32_t *colors);
+  void draw_triangle(const Triangle &triangle, const Transform &transform, Texture &texture);
+
+  // Each vertex in the mesh is transformed once and then shared by all
+  // the triangles that use it. Triangles are either one color, a color
+  // per triangle, or shaded with the vertex colors.
+  void draw_mesh(
+    const Mesh &mesh,
+    const Rotation &rotation,
+    int x, int y, int z,
+    uint32_t color);
+
+  void draw_mesh(
+    const Mesh &mesh,
+    const Rotation &rotation,
+    int x, int y, int z,
+    const uint32_t *triangle_colors);
+
+  void draw_mesh(
+    const Mesh &mesh,
+    const Rotation &rotation,
+    int x, int y, int z);
+
+  void draw_mesh(const Mesh &mesh, const Transform &transform, uint32_t color);
+  void draw_mesh(const Mesh &mesh, const Transform &transform, const uint32_t *triangle_colors);
+  void draw_mesh(const Mesh &mesh, const Transform &transform);
+
   void draw_picture(Picture &picture, int x, int y, int z = INT32_MIN);
   void draw_picture(Picture &picture, int x, int y, int width, int height, int z = INT32_MIN);
   void draw_picture_high_quality(Picture &picture, int x, int y, int width, int height, int z = INT32_MIN);
@@ -214,25 +326,239 @@ private:
     b = temp;
   }
 
-  void sort_vertexes(Triangle &triangle);
-  void sort_vertexes(Triangle &triangle, uint32_t *colors);
-  void sort_vertexes(Triangle &triangle, Texture &texture);
-  void rotate(Triangle &triangle, const Rotation &rotation);
-  void rotate(int &x, int &y, int &z, const Rotation &rotation);
-  void translation(Triangle &triangle, int x, int y, int z);
-  void projection(Triangle &triangle);
-  uint32_t calculate_alpha(uint32_t color, int pixel);
+  // A recorded draw call. Triangles are already transformed and every
+  // command keeps its bounding box clipped to the scissor it was drawn
+  // with. The rasterizer takes x and y from fixed_x and fixed_y, which
+  // keep the sub-pixel part the transform gave, and only z from v.
+  struct DrawCommand
+  {
+    enum Type
+    {
+      FLAT,
+      DEPTH,
+      COLORS,
+      TEXTURE,
+      RECT,
+      RECT_DEPTH
+    };
+
+    // Opaque depth tested commands can be drawn in any order.
+    bool is_sortable() const
+    {
+      return !alpha_blend && type != FLAT && type != RECT;
+    }
+
+    Type type;
+    Triangle v;
+    int64_t fixed_x[3], fixed_y[3];
+    uint32_t color;
+    uint32_t colors[3];
+    // Texture coordinates are in texels. They are multiplied by q, which
+    // is 1 / w with perspective correction and 1.0 without it.
+    const Texture *texture;
+    float texture_u[3], texture_v[3], texture_q[3];
+    bool alpha_blend;
+    int depth;
+    int x0, y0, x1, y1;
+  };
+
+  // Bounding box of everything drawn since the last clear().
+  struct DirtyRegion
+  {
+    DirtyRegion() { reset(); }
+
+    void reset()
+    {
+      x0 = INT32_MAX;
+      y0 = INT32_MAX;
+      x1 = INT32_MIN;
+      y1 = INT32_MIN;
+    }
+
+    void add(int ax0, int ay0, int ax1, int ay1)
+    {
+      if (ax0 < x0) { x0 = ax0; }
+      if (ay0 < y0) { y0 = ay0; }
+      if (ax1 > x1) { x1 = ax1; }
+      if (ay1 > y1) { y1 = ay1; }
+    }
+
+    bool is_empty() const { return x0 > x1; }
+
+    int x0, y0, x1, y1;
+  };
+
+  // Area must already be clipped to the picture.
+  void mark_dirty(int x0, int y0, int x1, int y1, bool has_z)
+  {
+    dirty.add(x0, y0, x1, y1);
+    if (has_z) { dirty_z.add(x0, y0, x1, y1); }
+  }
+
+  void mark_dirty_line(
+    int64_t x,
+    int64_t y,
+    int64_t step_x,
+    int64_t step_y,
+    int first,
+    int last,
+    bool has_z);
+
+  // Pixel index must already be clipped to the picture.
+  void put_pixel(int pixel, uint32_t color, bool alpha_blend)
+  {
+    if (is_32bit)
+    {
+      if (alpha_blend) { color = Span::blend(color, picture_32bit[pixel]); }
+
+      picture_32bit[pixel] = color;
+    }
+      else
+    {
+      picture[pixel] = color;
+    }
+  }
+
+  void put_pixel(int pixel, uint32_t color, bool alpha_blend, int z)
+  {
+    if (z < z_buffer[pixel]) { return; }
+
+    put_pixel(pixel, color, alpha_blend);
+
+    z_buffer[pixel] = z;
+  }
+
+  // Spans must already be clipped.
+  void fill_span(int y, int x0, int x1, uint32_t color, bool alpha_blend);
+  void fill_span(int y, int x0, int x1, uint32_t color, bool alpha_blend, int z);
+
+  // Writes a row of source pixels. Without depth testing z is INT32_MIN
+  // like the draw_picture() functions.
+  void copy_span(
+    int y,
+    int x0,
+    int x1,
+    const uint32_t *source,
+    bool alpha_blend,
+    int z);
+
+  // Corners can be in either order, so callers that work out x1 and y1
+  // from a width and height have to reject sizes <= 0 first.
+  bool clip_rect(int &x0, int &y0, int &x1, int &y1);
+  int get_outcode(int64_t x, int64_t y) const;
+
+  bool clip_line(
+    int64_t x,
+    int64_t y,
+    int64_t step_x,
+    int64_t step_y,
+    int steps,
+    int &first,
+    int &last) const;
+
+  void submit(DrawCommand &command);
+  bool is_recording() const { return is_deferred || worker_pool != nullptr; }
+  void record(const DrawCommand &command);
+  void sort_commands();
+  void draw_commands();
+  void draw_tile(int index);
+  void rasterize(const DrawCommand &command, int x0, int y0, int x1, int y1);
+  void rasterize(const DrawCommand &command, Rasterizer &rasterizer);
+  void rasterize_flat(const DrawCommand &command, Rasterizer &rasterizer);
+  void rasterize_depth(const DrawCommand &command, Rasterizer &rasterizer);
+  void rasterize_colors(const DrawCommand &command, Rasterizer &rasterizer);
+  void rasterize_texture(const DrawCommand &command, Rasterizer &rasterizer);
+
+  static int get_z_min(const Triangle &v)
+  {
+    int z = v.z0 < v.z1 ? v.z0 : v.z1;
+    return z < v.z2 ? z : v.z2;
+  }
+
+  static int get_z_max(const Triangle &v)
+  {
+    int z = v.z0 > v.z1 ? v.z0 : v.z1;
+    return z > v.z2 ? z : v.z2;
+  }
+
+  // Returns true if everything in the rectangle is farther than z_max.
+  bool is_occluded(int x0, int y0, int x1, int y1, int z_max);
+  bool is_occluded(const Rasterizer &rasterizer, int z_max);
+
+  // Raise the block depth for blocks completely covered at depth z or
+  // farther.
+  void update_z_blocks(int x0, int y0, int x1, int y1, int z);
+  void update_z_blocks(const Rasterizer &rasterizer, int z_min);
+
+  bool setup_triangle(Rasterizer &rasterizer, const DrawCommand &command);
+  void translation(DrawCommand &command, int x, int y, int z);
+
+  void apply_transform(DrawCommand &command, const Transform &transform)
+  {
+    double w[3];
+    apply_transform(command, transform, w);
+  }
+
+  // Also returns w for each vertex.
+  void apply_transform(
+    DrawCommand &command,
+    const Transform &transform,
+    double w[]);
+  void transform_mesh(const Mesh &mesh, const Transform &transform);
+
+  void submit_mesh(
+    const Mesh &mesh,
+    DrawCommand::Type type,
+    uint32_t color,
+    const uint32_t *triangle_colors);
 
   bool do_alpha_blending;
+  bool do_perspective_correction;
+  bool do_fast_math;
+  Rasterizer::CullMode cull_mode;
   bool is_32bit;
+  bool is_deferred;
   int width, height;
   int color_count;
   //int format;
   uint8_t *picture;
   uint32_t *picture_32bit;
   int16_t *z_buffer;
+  // Lowest depth in each Z_BLOCK_SIZE x Z_BLOCK_SIZE block of z_buffer.
+  // It's kept conservative (never above the real lowest depth) so it
+  // can reject primitives that are hidden before anything is shaded.
+  static const int Z_BLOCK_SIZE = 8;
+  int16_t *z_blocks;
   uint32_t palette[256];
   ImageWriter *image_writer;
+  // Same writer when the format is GIF, nullptr otherwise.
+  ImageWriterGif *image_writer_gif;
+  WorkerPool *worker_pool;
+  std::vector<DrawCommand> commands;
+  // Transformed mesh vertexes with x and y in 28.4 fixed point.
+  struct ScreenVertex
+  {
+    int64_t x, y;
+    int z;
+    uint32_t color;
+  };
+
+  std::vector<ScreenVertex> mesh_vertexes;
+  // Kept between scaled draw_picture() calls so they don't allocate.
+  std::vector<int> columns;
+  std::vector<uint32_t> scaled_row;
+  std::vector<uint32_t> scaled_picture;
+  Resampler resampler;
+  std::vector<std::vector<int> > tile_bins;
+  int tile_columns;
+  int tile_rows;
+  int clip_x0, clip_y0;
+  int clip_x1, clip_y1;
+  int z_block_columns;
+  int z_block_rows;
+  uint32_t clear_color;
+  DirtyRegion dirty;
+  DirtyRegion dirty_z;
 };
 
 #endif
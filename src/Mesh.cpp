@@ -0,0 +1,99 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Mesh.h"
+
+Mesh::Mesh(Type type) : type { type }
+{
+}
+
+Mesh::~Mesh()
+{
+}
+
+int Mesh::add_vertex(int x, int y, int z, uint32_t color)
+{
+  Vertex vertex;
+
+  vertex.x = x;
+  vertex.y = y;
+  vertex.z = z;
+  vertex.color = color;
+
+  vertexes.push_back(vertex);
+
+  return vertexes.size() - 1;
+}
+
+void Mesh::add_triangle(int i0, int i1, int i2)
+{
+  indexes.push_back(i0);
+  indexes.push_back(i1);
+  indexes.push_back(i2);
+}
+
+void Mesh::clear()
+{
+  vertexes.clear();
+  indexes.clear();
+}
+
+int Mesh::get_triangle_count() const
+{
+  int count = indexes.size();
+
+  switch (type)
+  {
+    case TRIANGLES:
+      return count / 3;
+    case TRIANGLE_STRIP:
+    case TRIANGLE_FAN:
+      return count < 3 ? 0 : count - 2;
+  }
+
+  return 0;
+}
+
+void Mesh::get_triangle(int n, int &i0, int &i1, int &i2) const
+{
+  switch (type)
+  {
+    case TRIANGLES:
+      i0 = indexes[(n * 3) + 0];
+      i1 = indexes[(n * 3) + 1];
+      i2 = indexes[(n * 3) + 2];
+      break;
+    case TRIANGLE_STRIP:
+      // Every other triangle in a strip is flipped to keep the winding.
+      if ((n & 1) == 0)
+      {
+        i0 = indexes[n + 0];
+        i1 = indexes[n + 1];
+      }
+        else
+      {
+        i0 = indexes[n + 1];
+        i1 = indexes[n + 0];
+      }
+
+      i2 = indexes[n + 2];
+      break;
+    case TRIANGLE_FAN:
+      i0 = indexes[0];
+      i1 = indexes[n + 1];
+      i2 = indexes[n + 2];
+      break;
+  }
+}
+
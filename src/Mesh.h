@@ -0,0 +1,64 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdint.h>
+
+#include <vector>
+
+// Vertex and index buffers for a model. Triangles that share a vertex
+// share its index, so each vertex only has to be transformed once per
+// draw no matter how many triangles use it.
+class Mesh
+{
+public:
+  enum Type
+  {
+    TRIANGLES,
+    TRIANGLE_STRIP,
+    TRIANGLE_FAN
+  };
+
+  struct Vertex
+  {
+    int x, y, z;
+    uint32_t color;
+  };
+
+  Mesh(Type type = TRIANGLES);
+  ~Mesh();
+
+  void set_type(Type value) { type = value; }
+  Type get_type() const { return type; }
+
+  // Returns the index of the new vertex.
+  int add_vertex(int x, int y, int z, uint32_t color = 0);
+  void add_index(int index) { indexes.push_back(index); }
+  void add_triangle(int i0, int i1, int i2);
+  void clear();
+
+  int get_vertex_count() const { return vertexes.size(); }
+  const Vertex &get_vertex(int index) const { return vertexes[index]; }
+
+  // Strips and fans are expanded here so callers only see triangles.
+  int get_triangle_count() const;
+  void get_triangle(int n, int &i0, int &i1, int &i2) const;
+
+private:
+  Type type;
+  std::vector<Vertex> vertexes;
+  std::vector<int> indexes;
+};
+
+#endif
+
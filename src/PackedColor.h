@@ -0,0 +1,104 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#ifndef PACKED_COLOR_H
+#define PACKED_COLOR_H
+
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// ARGB color with each channel in 16.16 fixed point that can be stepped
+// across a span. With SSE2 all four channels sit in one register.
+class PackedColor
+{
+public:
+  PackedColor()
+  {
+    set(0, 0, 0, 0);
+    set_step(0, 0, 0, 0);
+  }
+
+#ifdef __SSE2__
+  void set(int32_t a, int32_t r, int32_t g, int32_t b)
+  {
+    value = _mm_set_epi32(a, r, g, b);
+  }
+
+  void set_step(int32_t a, int32_t r, int32_t g, int32_t b)
+  {
+    delta = _mm_set_epi32(a, r, g, b);
+  }
+
+  void step() { value = _mm_add_epi32(value, delta); }
+
+  // Channels are clamped to 0 to 255 by the saturating packs.
+  uint32_t get() const
+  {
+    __m128i c = _mm_srai_epi32(value, 16);
+    c = _mm_packs_epi32(c, c);
+    c = _mm_packus_epi16(c, c);
+
+    return _mm_cvtsi128_si32(c);
+  }
+
+private:
+  __m128i value;
+  __m128i delta;
+#else
+  void set(int32_t a, int32_t r, int32_t g, int32_t b)
+  {
+    value[0] = b;
+    value[1] = g;
+    value[2] = r;
+    value[3] = a;
+  }
+
+  void set_step(int32_t a, int32_t r, int32_t g, int32_t b)
+  {
+    delta[0] = b;
+    delta[1] = g;
+    delta[2] = r;
+    delta[3] = a;
+  }
+
+  void step()
+  {
+    for (int n = 0; n < 4; n++) { value[n] += delta[n]; }
+  }
+
+  uint32_t get() const
+  {
+    uint32_t color = 0;
+
+    for (int n = 0; n < 4; n++)
+    {
+      int c = value[n] >> 16;
+
+      if (c < 0)   { c = 0; }
+      if (c > 255) { c = 255; }
+
+      color |= (uint32_t)c << (n * 8);
+    }
+
+    return color;
+  }
+
+private:
+  int32_t value[4];
+  int32_t delta[4];
+#endif
+};
+
+#endif
+
@@ -12,14 +12,23 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "ImageReaderBmp.h"
 #include "ImageReaderGif.h"
 #include "Picture.h"
+#include "Resampler.h"
 
 Picture::Picture() :
   data { nullptr },
   width { 0 },
-  height { 0 }
+  height { 0 },
+  do_summed_area_table { false },
+  is_summed_area_stale { true },
+  do_mipmaps { false },
+  is_mipmap_stale { true }
 {
 }
 
@@ -35,6 +44,7 @@ int Picture::create(int width, int height)
   this->height = height;
 
   data = (uint32_t *)malloc(width * height * sizeof(uint32_t));
+  mark_modified();
 
   return 0;
 }
@@ -152,6 +162,8 @@ void Picture::update_alpha(uint8_t value, uint32_t ignore_color)
 
 uint32_t Picture::get_scaled_pixel(double u, double v, double w, double h)
 {
+  if (do_summed_area_table) { return get_area_average(u, v, u + w, v + h); }
+
 #if 0
   // If this maps into a single pixel, skip the code below and just
   // return the value at (u , v).
@@ -255,3 +267,311 @@ uint32_t Picture::get_scaled_pixel(double u, double v, double w, double h)
   return (a << 24) | (r << 16) | (g << 8) | b;
 }
 
+void Picture::enable_summed_area_table(bool value)
+{
+  do_summed_area_table = value;
+
+  if (!value)
+  {
+    summed_area.clear();
+    summed_area.shrink_to_fit();
+    is_summed_area_stale = true;
+  }
+}
+
+uint32_t Picture::get_area_average(double x0, double y0, double x1, double y1)
+{
+  if (x0 < 0) { x0 = 0; }
+  if (y0 < 0) { y0 = 0; }
+  if (x1 > width) { x1 = width; }
+  if (y1 > height) { y1 = height; }
+
+  if (x1 <= x0 || y1 <= y0) { return 0; }
+
+  if (is_summed_area_stale) { build_summed_area_table(); }
+
+  double sum[4];
+
+  get_area_sum(sum, x0, y0, x1, y1);
+
+  const double scale = 1.0 / ((x1 - x0) * (y1 - y0));
+  uint32_t color = 0;
+
+  for (int c = 0; c < 4; c++)
+  {
+    int value = (int)((sum[c] * scale) + 0.5);
+
+    if (value < 0) { value = 0; }
+    if (value > 255) { value = 255; }
+
+    color |= value << (c * 8);
+  }
+
+  return color;
+}
+
+#ifdef __SSE2__
+// Lanes 0 and 1 as unsigned 32 bit values to doubles.
+static __m128d cvtepu32_pd(__m128i value)
+{
+  const __m128d d = _mm_cvtepi32_pd(value);
+  const __m128d is_wrapped = _mm_cmplt_pd(d, _mm_setzero_pd());
+
+  return _mm_add_pd(d, _mm_and_pd(is_wrapped, _mm_set1_pd(4294967296.0)));
+}
+#endif
+
+void Picture::get_area_sum(
+  double *sum,
+  double x0,
+  double y0,
+  double x1,
+  double y1)
+{
+  // The sum over [0, x) x [0, y) is the table bilinearly interpolated,
+  // so each corner is split into a whole pixel i and a fraction f.
+  int i0 = (int)x0, i1 = (int)x1;
+  int j0 = (int)y0, j1 = (int)y1;
+
+  if (i1 > width - 1) { i1 = width - 1; }
+  if (j1 > height - 1) { j1 = height - 1; }
+
+  // Sums are only exact mod 2^32, so boxes that could add up to more
+  // than that are split in two.
+  if ((int64_t)(i1 - i0 + 1) * (j1 - j0 + 1) > MAX_BOX_PIXELS)
+  {
+    double half[4];
+
+    if (i1 - i0 > j1 - j0)
+    {
+      const double x = (double)((i0 + i1 + 1) / 2);
+
+      get_area_sum(sum, x0, y0, x, y1);
+      get_area_sum(half, x, y0, x1, y1);
+    }
+      else
+    {
+      const double y = (double)((j0 + j1 + 1) / 2);
+
+      get_area_sum(sum, x0, y0, x1, y);
+      get_area_sum(half, x0, y, x1, y1);
+    }
+
+    for (int c = 0; c < 4; c++) { sum[c] += half[c]; }
+
+    return;
+  }
+
+  const double fx0 = x0 - i0, fx1 = x1 - i1;
+  const double fy0 = y0 - j0, fy1 = y1 - j1;
+
+  const int stride = (width + 1) * 4;
+  const uint32_t *s00 = summed_area.data() + (j0 * stride) + (i0 * 4);
+  const uint32_t *s10 = summed_area.data() + (j0 * stride) + (i1 * 4);
+  const uint32_t *s01 = summed_area.data() + (j1 * stride) + (i0 * 4);
+  const uint32_t *s11 = summed_area.data() + (j1 * stride) + (i1 * 4);
+
+  const uint32_t p00 = data[(j0 * width) + i0];
+  const uint32_t p10 = data[(j0 * width) + i1];
+  const uint32_t p01 = data[(j1 * width) + i0];
+  const uint32_t p11 = data[(j1 * width) + i1];
+
+#ifdef __SSE2__
+  // All 4 channels at once, the table keeps them next to each other.
+  const __m128i zero = _mm_setzero_si128();
+
+  __m128i box = _mm_add_epi32(
+    _mm_sub_epi32(_mm_loadu_si128((const __m128i *)s11), _mm_loadu_si128((const __m128i *)s01)),
+    _mm_sub_epi32(_mm_loadu_si128((const __m128i *)s00), _mm_loadu_si128((const __m128i *)s10)));
+  __m128i column_0 = _mm_sub_epi32(
+    _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(s01 + 4)), _mm_loadu_si128((const __m128i *)s01)),
+    _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(s00 + 4)), _mm_loadu_si128((const __m128i *)s00)));
+  __m128i column_1 = _mm_sub_epi32(
+    _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(s11 + 4)), _mm_loadu_si128((const __m128i *)s11)),
+    _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(s10 + 4)), _mm_loadu_si128((const __m128i *)s10)));
+  __m128i row_0 = _mm_sub_epi32(
+    _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(s10 + stride)), _mm_loadu_si128((const __m128i *)(s00 + stride))),
+    _mm_sub_epi32(_mm_loadu_si128((const __m128i *)s10), _mm_loadu_si128((const __m128i *)s00)));
+  __m128i row_1 = _mm_sub_epi32(
+    _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(s11 + stride)), _mm_loadu_si128((const __m128i *)(s01 + stride))),
+    _mm_sub_epi32(_mm_loadu_si128((const __m128i *)s11), _mm_loadu_si128((const __m128i *)s01)));
+
+  __m128i corners_0 = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, p10, p00), zero);
+  __m128i corners_1 = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, p11, p01), zero);
+  __m128i c00 = _mm_unpacklo_epi16(corners_0, zero);
+  __m128i c10 = _mm_unpackhi_epi16(corners_0, zero);
+  __m128i c01 = _mm_unpacklo_epi16(corners_1, zero);
+  __m128i c11 = _mm_unpackhi_epi16(corners_1, zero);
+
+  const __m128d w_column_0 = _mm_set1_pd(-fx0);
+  const __m128d w_column_1 = _mm_set1_pd(fx1);
+  const __m128d w_row_0 = _mm_set1_pd(-fy0);
+  const __m128d w_row_1 = _mm_set1_pd(fy1);
+  const __m128d w00 = _mm_set1_pd(fx0 * fy0);
+  const __m128d w10 = _mm_set1_pd(-fx1 * fy0);
+  const __m128d w01 = _mm_set1_pd(-fx0 * fy1);
+  const __m128d w11 = _mm_set1_pd(fx1 * fy1);
+
+  for (int half = 0; half < 2; half++)
+  {
+    if (half == 1)
+    {
+      box = _mm_srli_si128(box, 8);
+      column_0 = _mm_srli_si128(column_0, 8);
+      column_1 = _mm_srli_si128(column_1, 8);
+      row_0 = _mm_srli_si128(row_0, 8);
+      row_1 = _mm_srli_si128(row_1, 8);
+      c00 = _mm_srli_si128(c00, 8);
+      c10 = _mm_srli_si128(c10, 8);
+      c01 = _mm_srli_si128(c01, 8);
+      c11 = _mm_srli_si128(c11, 8);
+    }
+
+    __m128d edges = _mm_add_pd(
+      _mm_add_pd(
+        _mm_mul_pd(w_column_0, cvtepu32_pd(column_0)),
+        _mm_mul_pd(w_column_1, cvtepu32_pd(column_1))),
+      _mm_add_pd(
+        _mm_mul_pd(w_row_0, cvtepu32_pd(row_0)),
+        _mm_mul_pd(w_row_1, cvtepu32_pd(row_1))));
+    __m128d corners = _mm_add_pd(
+      _mm_add_pd(
+        _mm_mul_pd(w00, _mm_cvtepi32_pd(c00)),
+        _mm_mul_pd(w10, _mm_cvtepi32_pd(c10))),
+      _mm_add_pd(
+        _mm_mul_pd(w01, _mm_cvtepi32_pd(c01)),
+        _mm_mul_pd(w11, _mm_cvtepi32_pd(c11))));
+
+    _mm_storeu_pd(
+      sum + (half * 2),
+      _mm_add_pd(cvtepu32_pd(box), _mm_add_pd(edges, corners)));
+  }
+#else
+  for (int c = 0; c < 4; c++)
+  {
+    // Whole pixels [i0, i1) x [j0, j1), columns i0 and i1 and rows j0
+    // and j1 over that range, then the 4 corner pixels.
+    uint32_t box = s11[c] - s01[c] - s10[c] + s00[c];
+    uint32_t column_0 = (s01[c + 4] - s01[c]) - (s00[c + 4] - s00[c]);
+    uint32_t column_1 = (s11[c + 4] - s11[c]) - (s10[c + 4] - s10[c]);
+    uint32_t row_0 = (s10[c + stride] - s00[c + stride]) - (s10[c] - s00[c]);
+    uint32_t row_1 = (s11[c + stride] - s01[c + stride]) - (s11[c] - s01[c]);
+
+    const int shift = c * 8;
+
+    sum[c] =
+      box +
+      (fx1 * column_1) - (fx0 * column_0) +
+      (fy1 * row_1) - (fy0 * row_0) +
+      (fx1 * fy1 * ((p11 >> shift) & 0xff)) -
+      (fx0 * fy1 * ((p01 >> shift) & 0xff)) -
+      (fx1 * fy0 * ((p10 >> shift) & 0xff)) +
+      (fx0 * fy0 * ((p00 >> shift) & 0xff));
+  }
+#endif
+}
+
+void Picture::build_summed_area_table()
+{
+  const int stride = (width + 1) * 4;
+
+  summed_area.assign(stride * (height + 1), 0);
+
+  for (int y = 0; y < height; y++)
+  {
+    const uint32_t *above = summed_area.data() + (y * stride);
+    uint32_t *row = summed_area.data() + ((y + 1) * stride);
+    uint32_t sum[4] = { 0, 0, 0, 0 };
+
+    for (int x = 0; x < width; x++)
+    {
+      const uint32_t color = data[(y * width) + x];
+
+      for (int c = 0; c < 4; c++)
+      {
+        sum[c] += (color >> (c * 8)) & 0xff;
+        row[((x + 1) * 4) + c] = above[((x + 1) * 4) + c] + sum[c];
+      }
+    }
+  }
+
+  is_summed_area_stale = false;
+}
+
+void Picture::enable_mipmaps(bool value)
+{
+  do_mipmaps = value;
+
+  if (!value)
+  {
+    mipmaps.clear();
+    mipmaps.shrink_to_fit();
+    is_mipmap_stale = true;
+  }
+}
+
+Picture::Mipmap Picture::get_mipmap(int width, int height)
+{
+  Mipmap mipmap = { data, this->width, this->height };
+
+  if (!do_mipmaps) { return mipmap; }
+
+  if (is_mipmap_stale) { build_mipmaps(); }
+
+  for (const MipmapLevel &level : mipmaps)
+  {
+    if (level.width < width || level.height < height) { break; }
+
+    mipmap.data = level.data.data();
+    mipmap.width = level.width;
+    mipmap.height = level.height;
+  }
+
+  return mipmap;
+}
+
+void Picture::build_mipmaps()
+{
+  // Odd sizes round up, so the area filter blends the last row or
+  // column into its neighbours instead of dropping it.
+  int count = 0;
+
+  for (int w = width, h = height; w > 1 || h > 1; count++)
+  {
+    w = (w + 1) / 2;
+    h = (h + 1) / 2;
+  }
+
+  mipmaps.resize(count);
+
+  Resampler resampler;
+  const uint32_t *source = data;
+  int source_width = width;
+  int source_height = height;
+
+  for (MipmapLevel &level : mipmaps)
+  {
+    level.width = (source_width + 1) / 2;
+    level.height = (source_height + 1) / 2;
+    level.data.resize(level.width * level.height);
+
+    resampler.scale(
+      level.data.data(),
+      source,
+      source_width,
+      source_height,
+      level.width,
+      level.height,
+      0,
+      0,
+      level.width - 1,
+      level.height - 1,
+      nullptr);
+
+    source = level.data.data();
+    source_width = level.width;
+    source_height = level.height;
+  }
+
+  is_mipmap_stale = false;
+}
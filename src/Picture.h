@@ -14,6 +14,8 @@
 
 #include <stdint.h>
 
+#include <vector>
+
 class Picture
 {
 public:
@@ -46,6 +48,7 @@ public:
   {
     if (data != nullptr) { free(data); }
     data = value;
+    mark_modified();
   }
 
   uint32_t get_pixel(int x, int y)
@@ -58,12 +61,49 @@ public:
 
   uint32_t get_scaled_pixel(double u, double v, double w, double h);
 
+  // The summed area table and mipmaps below are built the first time
+  // they're needed after the picture changes. If pixels are written
+  // through get_data(), call mark_modified() afterwards.
+  void mark_modified()
+  {
+    is_summed_area_stale = true;
+    is_mipmap_stale = true;
+  }
+
+  // With a summed area table any box average costs the same number of
+  // lookups no matter how big the box is. It takes 16 bytes per pixel.
+  void enable_summed_area_table(bool value);
+  bool has_summed_area_table() const { return do_summed_area_table; }
+
+  // Average of the area [x0, x1) x [y0, y1) clipped to the picture.
+  // Edges can be fractional, partly covered pixels are weighted by how
+  // much of them is covered. Needs enable_summed_area_table().
+  uint32_t get_area_average(double x0, double y0, double x1, double y1);
+
+  // Box filtered copies of the picture, each half the size of the one
+  // before it down to 1 x 1, for drawing it smaller. They take a third
+  // more memory. Level 0 is the picture itself.
+  void enable_mipmaps(bool value);
+  bool has_mipmaps() const { return do_mipmaps; }
+
+  struct Mipmap
+  {
+    const uint32_t *data;
+    int width;
+    int height;
+  };
+
+  // Smallest level at least width x height, so drawing from it shrinks
+  // by less than half. Level 0 if mipmaps aren't enabled.
+  Mipmap get_mipmap(int width, int height);
+
   void set_pixel(int x, int y, uint32_t color)
   {
     if (x < 0 || x >= width) { return; }
     if (y < 0 || y >= height) { return; }
 
     data[(y * width) + x] = color;
+    mark_modified();
   }
 
   uint32_t get_pixel(int index)
@@ -78,13 +118,39 @@ public:
     if (index < 0 || index > width * height) { return; }
 
     data[index] = color;
+    mark_modified();
   }
 
 private:
+  void build_summed_area_table();
+  void get_area_sum(double *sum, double x0, double y0, double x1, double y1);
+  void build_mipmaps();
+
   uint32_t *data;
   int width;
   int height;
 
+  // (width + 1) x (height + 1) entries of 4 channels, each the sum of the
+  // pixels above and to the left. The sums wrap, but differences of them
+  // come out right for any box of up to MAX_BOX_PIXELS pixels.
+  static const int64_t MAX_BOX_PIXELS = 0xffffffff / 255;
+
+  std::vector<uint32_t> summed_area;
+  bool do_summed_area_table;
+  bool is_summed_area_stale;
+
+  struct MipmapLevel
+  {
+    int width;
+    int height;
+    std::vector<uint32_t> data;
+  };
+
+  // Levels 1 and smaller.
+  std::vector<MipmapLevel> mipmaps;
+  bool do_mipmaps;
+  bool is_mipmap_stale;
+
 };
 
 #endif
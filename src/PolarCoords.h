@@ -15,6 +15,8 @@
 #include <stdint.h>
 #include <math.h>
 
+#include "FastMath.h"
+
 class PolarCoords
 {
 public:
@@ -80,6 +82,23 @@ printf("to_xy(%.3f, %.3f)\n",
     y = round((double)r * sin(p0));
   }
 
+  // Same as from_xy() and to_xy() but with FastMath instead of libm.
+  static void from_xy_fast(double &p, int &r, const int x, const int y)
+  {
+    r = (int)sqrt(((double)x * x) + ((double)y * y));
+    p = adjust_if_negative(FastMath::atan2(y, x));
+  }
+
+  static void to_xy_fast(int &x, int &y, const double p, const int r)
+  {
+    double s, c;
+
+    FastMath::sin_cos(p, s, c);
+
+    x = FastMath::round_to_int((double)r * c);
+    y = FastMath::round_to_int((double)r * s);
+  }
+
   void from_xy(const int x, const int y)
   {
     from_xy(p, r, x, y);
@@ -98,6 +117,14 @@ printf("to_xy(%.3f, %.3f)\n",
     y = center_y - y;
   }
 
+  void to_xy_centered_fast(int &x, int &y) const
+  {
+    to_xy_fast(x, y, p, r);
+
+    x = center_x + x;
+    y = center_y - y;
+  }
+
   void from_xy_centered(double &p, int &r, const int x, const int y)
   {
     from_xy(p, r, x - center_x, center_y - y);
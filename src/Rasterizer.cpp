@@ -0,0 +1,352 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "Rasterizer.h"
+
+// Keep vertexes small enough that edge function products fit in 64 bits.
+static const int64_t GUARD_BAND = 1 << 26;
+
+static bool is_in_guard_band(int64_t value)
+{
+  return value >= -GUARD_BAND && value <= GUARD_BAND;
+}
+
+// Where the edge from (x0, y0) to (x1, y1) crosses x = side (or y = side
+// if is_y), rounded to the subpixel grid. The end points are put in the
+// same order first so triangles that share an edge get the same point.
+static void get_crossing(
+  int64_t &x,
+  int64_t &y,
+  int64_t x0, int64_t y0,
+  int64_t x1, int64_t y1,
+  int64_t side,
+  bool is_y)
+{
+  if (x1 < x0 || (x1 == x0 && y1 < y0))
+  {
+    int64_t t;
+    t = x0; x0 = x1; x1 = t;
+    t = y0; y0 = y1; y1 = t;
+  }
+
+  if (is_y)
+  {
+    double t = (double)(side - y0) / (double)(y1 - y0);
+    x = x0 + llround(t * (double)(x1 - x0));
+    y = side;
+  }
+    else
+  {
+    double t = (double)(side - x0) / (double)(x1 - x0);
+    x = side;
+    y = y0 + llround(t * (double)(y1 - y0));
+  }
+}
+
+// Sutherland-Hodgman clip of the polygon in x, y to the guard band.
+// Returns the new number of points.
+static int clip_guard_band(int64_t *x, int64_t *y, int count)
+{
+  int64_t in_x[7], in_y[7];
+
+  for (int side = 0; side < 4; side++)
+  {
+    const bool is_y = side >= 2;
+    const int64_t limit = (side & 1) == 0 ? -GUARD_BAND : GUARD_BAND;
+    int length = 0;
+
+    for (int n = 0; n < count; n++)
+    {
+      in_x[n] = x[n];
+      in_y[n] = y[n];
+    }
+
+    for (int n = 0; n < count; n++)
+    {
+      const int prev = n == 0 ? count - 1 : n - 1;
+      const int64_t a = is_y ? in_y[prev] : in_x[prev];
+      const int64_t b = is_y ? in_y[n] : in_x[n];
+      const bool is_a_in = (side & 1) == 0 ? a >= limit : a <= limit;
+      const bool is_b_in = (side & 1) == 0 ? b >= limit : b <= limit;
+
+      if (is_a_in != is_b_in)
+      {
+        get_crossing(
+          x[length], y[length],
+          in_x[prev], in_y[prev],
+          in_x[n], in_y[n],
+          limit,
+          is_y);
+
+        length++;
+      }
+
+      if (is_b_in)
+      {
+        x[length] = in_x[n];
+        y[length] = in_y[n];
+        length++;
+      }
+    }
+
+    count = length;
+  }
+
+  // Rounding can put two crossings on the same point.
+  int length = 0;
+
+  for (int n = 0; n < count; n++)
+  {
+    if (length != 0 && x[n] == x[length - 1] && y[n] == y[length - 1])
+    {
+      continue;
+    }
+
+    x[length] = x[n];
+    y[length] = y[n];
+    length++;
+  }
+
+  while (length > 1 && x[0] == x[length - 1] && y[0] == y[length - 1])
+  {
+    length--;
+  }
+
+  return length;
+}
+
+static int64_t floor_div(int64_t n, int64_t d)
+{
+  if (d < 0) { n = -n; d = -d; }
+
+  int64_t q = n / d;
+  if (q * d != n && n < 0) { q--; }
+
+  return q;
+}
+
+static int64_t ceil_div(int64_t n, int64_t d)
+{
+  return -floor_div(-n, d);
+}
+
+Rasterizer::Rasterizer() :
+  edge_count { 0 },
+  clip_x0 {  0 },
+  clip_y0 {  0 },
+  clip_x1 { -1 },
+  clip_y1 { -1 },
+  cull_mode { CULL_NONE },
+  x_start {  0 },
+  x_end   { -1 },
+  y_start {  0 },
+  y_end   { -1 },
+  area    {  0 },
+  det     { 0.0 }
+{
+}
+
+Rasterizer::~Rasterizer()
+{
+}
+
+void Rasterizer::set_clip(int x0, int y0, int x1, int y1)
+{
+  clip_x0 = x0;
+  clip_y0 = y0;
+  clip_x1 = x1;
+  clip_y1 = y1;
+}
+
+bool Rasterizer::setup(
+  int64_t x0, int64_t y0,
+  int64_t x1, int64_t y1,
+  int64_t x2, int64_t y2)
+{
+  vx[0] = x0;
+  vy[0] = y0;
+  vx[1] = x1;
+  vy[1] = y1;
+  vx[2] = x2;
+  vy[2] = y2;
+
+  int64_t px[MAX_EDGES] = { x0, x1, x2 };
+  int64_t py[MAX_EDGES] = { y0, y1, y2 };
+  int count = 3;
+
+  if (is_in_guard_band(x0) && is_in_guard_band(y0) &&
+      is_in_guard_band(x1) && is_in_guard_band(y1) &&
+      is_in_guard_band(x2) && is_in_guard_band(y2))
+  {
+    area = ((x1 - x0) * (y2 - y0)) - ((x2 - x0) * (y1 - y0));
+    det = (double)area;
+  }
+    else
+  {
+    // The gradients still come from the real vertexes, so only the
+    // edges that cross the band are moved (by less than a subpixel).
+    count = clip_guard_band(px, py, count);
+
+    if (count < 3) { return false; }
+
+    area = 0;
+
+    for (int n = 0; n < count; n++)
+    {
+      const int next = n == count - 1 ? 0 : n + 1;
+      area += (px[n] * py[next]) - (px[next] * py[n]);
+    }
+
+    det =
+      ((double)(x1 - x0) * (double)(y2 - y0)) -
+      ((double)(x2 - x0) * (double)(y1 - y0));
+  }
+
+  if (area == 0) { return false; }
+
+  // With y pointing down a positive area is clockwise.
+  if (cull_mode == CULL_CLOCKWISE && area > 0) { return false; }
+  if (cull_mode == CULL_COUNTER_CLOCKWISE && area < 0) { return false; }
+
+  int64_t min_vx = px[0], max_vx = px[0];
+  int64_t min_vy = py[0], max_vy = py[0];
+
+  for (int n = 1; n < count; n++)
+  {
+    if (px[n] < min_vx) { min_vx = px[n]; }
+    if (px[n] > max_vx) { max_vx = px[n]; }
+    if (py[n] < min_vy) { min_vy = py[n]; }
+    if (py[n] > max_vy) { max_vy = py[n]; }
+  }
+
+  // Bounding box of pixel centers, clipped.
+  int64_t min_x = ceil_div(min_vx, SUBPIXEL_ONE);
+  int64_t max_x = floor_div(max_vx, SUBPIXEL_ONE);
+  int64_t min_y = ceil_div(min_vy, SUBPIXEL_ONE);
+  int64_t max_y = floor_div(max_vy, SUBPIXEL_ONE);
+
+  if (min_x < clip_x0) { min_x = clip_x0; }
+  if (max_x > clip_x1) { max_x = clip_x1; }
+  if (min_y < clip_y0) { min_y = clip_y0; }
+  if (max_y > clip_y1) { max_y = clip_y1; }
+
+  if (min_x > max_x || min_y > max_y) { return false; }
+
+  x_start = min_x;
+  x_end   = max_x;
+  y_start = min_y;
+  y_end   = max_y;
+
+  // Orient the edges so the inside of the triangle is always positive.
+  edge_count = count;
+
+  for (int n = 0; n < count; n++)
+  {
+    const int next = n == count - 1 ? 0 : n + 1;
+
+    if (area > 0)
+    {
+      set_edge(edges[n], px[n], py[n], px[next], py[next]);
+    }
+      else
+    {
+      set_edge(edges[n], px[next], py[next], px[n], py[n]);
+    }
+  }
+
+  return true;
+}
+
+bool Rasterizer::get_span(int y, int &x0, int &x1) const
+{
+  int64_t py = (int64_t)y * SUBPIXEL_ONE;
+  int64_t left = x_start;
+  int64_t right = x_end;
+
+  for (int n = 0; n < edge_count; n++)
+  {
+    const Edge &edge = edges[n];
+
+    // E(px, py) = k - dy * px and the pixel is inside if E >= bias.
+    int64_t k = (edge.dx * (py - edge.y)) + (edge.dy * edge.x);
+    int64_t a = -edge.dy * SUBPIXEL_ONE;
+    int64_t t = edge.bias - k;
+
+    if (a > 0)
+    {
+      int64_t x = ceil_div(t, a);
+      if (x > left) { left = x; }
+    }
+      else
+    if (a < 0)
+    {
+      int64_t x = floor_div(t, a);
+      if (x < right) { right = x; }
+    }
+      else
+    {
+      if (k < edge.bias) { return false; }
+    }
+  }
+
+  if (left > right) { return false; }
+
+  x0 = left;
+  x1 = right;
+
+  return true;
+}
+
+void Rasterizer::compute_gradient(
+  Gradient &gradient,
+  double f0,
+  double f1,
+  double f2) const
+{
+  double d1 = f1 - f0;
+  double d2 = f2 - f0;
+  double dx1 = vx[1] - vx[0];
+  double dy1 = vy[1] - vy[0];
+  double dx2 = vx[2] - vx[0];
+  double dy2 = vy[2] - vy[0];
+
+  // Change per 1/16th of a pixel.
+  double dfdx = ((d1 * dy2) - (d2 * dy1)) / det;
+  double dfdy = ((d2 * dx1) - (d1 * dx2)) / det;
+
+  gradient.dx = dfdx * SUBPIXEL_ONE;
+  gradient.dy = dfdy * SUBPIXEL_ONE;
+  gradient.value = f0 - (dfdx * vx[0]) - (dfdy * vy[0]);
+}
+
+void Rasterizer::set_edge(
+  Edge &edge,
+  int64_t x0,
+  int64_t y0,
+  int64_t x1,
+  int64_t y1)
+{
+  edge.x = x0;
+  edge.y = y0;
+  edge.dx = x1 - x0;
+  edge.dy = y1 - y0;
+
+  // Top edge is horizontal with the inside below it, left edge goes up.
+  bool is_top_left = edge.dy < 0 || (edge.dy == 0 && edge.dx > 0);
+
+  edge.bias = is_top_left ? 0 : 1;
+}
+
@@ -0,0 +1,155 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <math.h>
+#include <stdint.h>
+
+// Triangle setup using integer edge functions. Vertexes are given in
+// 28.4 fixed point and pixel (x, y) is sampled at (x << 4, y << 4).
+// Pixels that fall exactly on an edge are only drawn if the edge is a
+// top or left edge, so triangles that share an edge never draw it twice.
+// Triangles reaching past the guard band are clipped to it first.
+class Rasterizer
+{
+public:
+  static const int SUBPIXEL_BITS = 4;
+  static const int SUBPIXEL_ONE  = 1 << SUBPIXEL_BITS;
+
+  Rasterizer();
+  ~Rasterizer();
+
+  static int64_t to_fixed(int value) { return (int64_t)value * SUBPIXEL_ONE; }
+
+  // Rounded to the nearest subpixel and limited to the range an int
+  // pixel coordinate has.
+  static int64_t to_fixed(double value)
+  {
+    const double limit = (double)INT32_MAX;
+
+    if (value < -limit) { return to_fixed(-INT32_MAX); }
+    if (value >  limit) { return to_fixed(INT32_MAX); }
+    return llround(value * SUBPIXEL_ONE);
+  }
+
+  static int32_t to_fixed_16(double value)
+  {
+    if (value < -32767.0) { return -32767 * 65536; }
+    if (value >  32767.0) { return  32767 * 65536; }
+    return (int32_t)(value * 65536);
+  }
+
+  static int32_t clamp_fixed_16(int64_t value)
+  {
+    if (value < -32767 * 65536) { return -32767 * 65536; }
+    if (value >  32767 * 65536) { return  32767 * 65536; }
+    return (int32_t)value;
+  }
+
+  // 16.16 fixed point in 64 bits, limited to +/- 2^24 so it can be
+  // multiplied by a pixel offset.
+  static int64_t to_fixed_64(double value)
+  {
+    const double limit = (double)(1LL << 40);
+
+    if (value < -limit) { return -(1LL << 40); }
+    if (value >  limit) { return  (1LL << 40); }
+    return (int64_t)(value * 65536);
+  }
+
+  // Inclusive rectangle of pixels that are allowed to be drawn.
+  void set_clip(int x0, int y0, int x1, int y1);
+
+  // Winding is as seen on screen with y pointing down. Triangles with the
+  // culled winding are rejected by setup() the same as ones with no area.
+  enum CullMode
+  {
+    CULL_NONE,
+    CULL_CLOCKWISE,
+    CULL_COUNTER_CLOCKWISE
+  };
+
+  void set_cull_mode(CullMode value) { cull_mode = value; }
+
+  // Returns false if the triangle has no area, is culled or is outside
+  // the clip.
+  bool setup(
+    int64_t x0, int64_t y0,
+    int64_t x1, int64_t y1,
+    int64_t x2, int64_t y2);
+
+  int get_x_start() const { return x_start; }
+  int get_x_end()   const { return x_end; }
+  int get_y_start() const { return y_start; }
+  int get_y_end()   const { return y_end; }
+
+  // Returns the inclusive range of pixels on row y inside the triangle.
+  bool get_span(int y, int &x_start, int &x_end) const;
+
+  // Plane equation for a value interpolated across the triangle.
+  struct Gradient
+  {
+    Gradient() : value { 0.0 }, dx { 0.0 }, dy { 0.0 } { }
+
+    double get(int x, int y) const { return value + (dx * x) + (dy * y); }
+
+    // 16.16 fixed point versions for stepping across a span.
+    int32_t get_fixed_dx() const { return to_fixed_16(dx); }
+    int64_t get_fixed_dx_64() const { return to_fixed_64(dx); }
+
+    // Value at x on row y stepped from x_reference, so any x_reference
+    // every tile agrees on gives the same result however a span is split.
+    // The plane can be far out of range at x_reference when the triangle
+    // is thin, so this is kept in 64 bits and not clamped.
+    int64_t get_fixed_64(int x_reference, int x, int y) const
+    {
+      return to_fixed_64(get(x_reference, y)) +
+        ((int64_t)(x - x_reference) * get_fixed_dx_64());
+    }
+
+    double value;
+    double dx, dy;
+  };
+
+  void compute_gradient(Gradient &gradient, double f0, double f1, double f2) const;
+
+private:
+  struct Edge
+  {
+    int64_t x, y;
+    int64_t dx, dy;
+    int bias;
+  };
+
+  // A triangle clipped by the 4 sides of the guard band.
+  static const int MAX_EDGES = 7;
+
+  void set_edge(Edge &edge, int64_t x0, int64_t y0, int64_t x1, int64_t y1);
+
+  Edge edges[MAX_EDGES];
+  int edge_count;
+
+  int clip_x0, clip_y0;
+  int clip_x1, clip_y1;
+  CullMode cull_mode;
+
+  int x_start, x_end;
+  int y_start, y_end;
+
+  int64_t vx[3], vy[3];
+  int64_t area;
+  double det;
+};
+
+#endif
+
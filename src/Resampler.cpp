@@ -0,0 +1,380 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Resampler.h"
+
+static int clamp_channel(int value)
+{
+  if (value < 0) { return 0; }
+  if (value > 255) { return 255; }
+  return value;
+}
+
+// Runs function(band) for each band on the worker pool if there is one.
+static void run_bands(
+  WorkerPool *worker_pool,
+  int count,
+  const std::function<void(int)> &function)
+{
+  if (worker_pool == nullptr || count == 1)
+  {
+    for (int n = 0; n < count; n++) { function(n); }
+  }
+    else
+  {
+    worker_pool->run(count, function);
+  }
+}
+
+Resampler::Resampler() :
+  filter     { FILTER_AREA },
+  temp_first { 0 },
+  temp_width { 0 }
+{
+}
+
+Resampler::~Resampler()
+{
+}
+
+void Resampler::scale(
+  uint32_t *dest,
+  const uint32_t *source,
+  int source_width,
+  int source_height,
+  int width,
+  int height,
+  int x0,
+  int y0,
+  int x1,
+  int y1,
+  WorkerPool *worker_pool)
+{
+  if (width <= 0 || height <= 0) { return; }
+  if (source_width <= 0 || source_height <= 0) { return; }
+  if (x0 < 0 || y0 < 0 || x1 >= width || y1 >= height) { return; }
+  if (x0 > x1 || y0 > y1) { return; }
+
+  compute_weights(weights_x, source_width, width, x0, x1);
+  compute_weights(weights_y, source_height, height, y0, y1);
+
+  const int rows = y1 - y0 + 1;
+  int temp_last = 0;
+
+  temp_first = source_height;
+  temp_width = x1 - x0 + 1;
+
+  for (int n = 0; n < rows; n++)
+  {
+    const int start = weights_y.start[n];
+    const int end = start + weights_y.count[n] - 1;
+
+    if (start < temp_first) { temp_first = start; }
+    if (end > temp_last) { temp_last = end; }
+  }
+
+  const int temp_rows = temp_last - temp_first + 1;
+
+  temp.resize(temp_rows * temp_width);
+
+  run_bands(
+    worker_pool,
+    (temp_rows + BAND_ROWS - 1) / BAND_ROWS,
+    [&](int band)
+    {
+      int first = band * BAND_ROWS;
+      int last = first + BAND_ROWS < temp_rows ? first + BAND_ROWS : temp_rows;
+
+      for (int y = first; y < last; y++)
+      {
+        filter_row(
+          temp.data() + (y * temp_width),
+          source + ((temp_first + y) * source_width),
+          temp_width);
+      }
+    });
+
+  run_bands(
+    worker_pool,
+    (rows + BAND_ROWS - 1) / BAND_ROWS,
+    [&](int band)
+    {
+      int first = band * BAND_ROWS;
+      int last = first + BAND_ROWS < rows ? first + BAND_ROWS : rows;
+
+      for (int y = first; y < last; y++)
+      {
+        filter_column(dest + (y * temp_width), y, temp_width);
+      }
+    });
+}
+
+void Resampler::compute_weights(
+  Weights &weights,
+  int source_size,
+  int size,
+  int first,
+  int last)
+{
+  const int length = last - first + 1;
+  const double scale = (double)source_size / (double)size;
+  const double support_scale = scale > 1.0 ? scale : 1.0;
+
+  weights.start.resize(length);
+  weights.count.resize(length);
+  weights.offset.resize(length);
+  weights.values.clear();
+
+  for (int n = 0; n < length; n++)
+  {
+    const int i = first + n;
+    int j0;
+
+    taps.clear();
+
+    if (filter == FILTER_LANCZOS3)
+    {
+      double center = (i + 0.5) * scale;
+      double support = 3.0 * support_scale;
+
+      j0 = (int)floor(center - support);
+      int j1 = (int)ceil(center + support);
+
+      for (int j = j0; j <= j1; j++)
+      {
+        taps.push_back(lanczos3((j + 0.5 - center) / support_scale));
+      }
+    }
+      else
+    if (scale >= 1.0)
+    {
+      // Overlap of each source pixel with [lo, hi).
+      double lo = i * scale;
+      double hi = lo + scale;
+
+      j0 = (int)floor(lo);
+      int j1 = (int)ceil(hi) - 1;
+
+      for (int j = j0; j <= j1; j++)
+      {
+        double a = j > lo ? j : lo;
+        double b = j + 1 < hi ? j + 1 : hi;
+
+        taps.push_back(b - a);
+      }
+    }
+      else
+    {
+      double center = ((i + 0.5) * scale) - 0.5;
+
+      j0 = (int)floor(center);
+
+      double f = center - j0;
+
+      taps.push_back(1.0 - f);
+      taps.push_back(f);
+    }
+
+    // Leave out taps past the edges and ones that don't contribute.
+    int k0 = j0 < 0 ? -j0 : 0;
+    int k1 = (int)taps.size() - 1;
+
+    if (j0 + k1 > source_size - 1) { k1 = source_size - 1 - j0; }
+
+    while (k0 < k1 && taps[k0] == 0.0) { k0++; }
+    while (k1 > k0 && taps[k1] == 0.0) { k1--; }
+
+    double total = 0;
+
+    for (int k = k0; k <= k1; k++) { total += taps[k]; }
+
+    if (total <= 0.0)
+    {
+      k1 = k0;
+      taps[k0] = total = 1.0;
+    }
+
+    // Round to fixed point and give whatever is left over to the biggest
+    // weight so a solid color comes out unchanged.
+    const int one = 1 << WEIGHT_BITS;
+    const int offset = weights.values.size();
+    int sum = 0;
+    int biggest = offset;
+
+    for (int k = k0; k <= k1; k++)
+    {
+      int value = (int)floor((taps[k] / total * one) + 0.5);
+
+      weights.values.push_back(value);
+      sum += value;
+
+      if (value > weights.values[biggest]) { biggest = weights.values.size() - 1; }
+    }
+
+    weights.values[biggest] += one - sum;
+
+    weights.start[n] = j0 + k0;
+    weights.count[n] = k1 - k0 + 1;
+    weights.offset[n] = offset;
+  }
+}
+
+void Resampler::filter_row(
+  uint32_t *dest,
+  const uint32_t *source,
+  int length) const
+{
+  const int round = 1 << (WEIGHT_BITS - 1);
+
+  for (int n = 0; n < length; n++)
+  {
+    const uint32_t *s = source + weights_x.start[n];
+    const int16_t *w = weights_x.values.data() + weights_x.offset[n];
+    const int count = weights_x.count[n];
+
+#ifdef __SSE2__
+    // Each channel in its own 32 bit lane. Pairing it with a 0 weight in
+    // the high half lets madd do a 16 x 16 -> 32 bit multiply.
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = _mm_set1_epi32(round);
+
+    for (int k = 0; k < count; k++)
+    {
+      __m128i pixel = _mm_unpacklo_epi8(_mm_cvtsi32_si128(s[k]), zero);
+      pixel = _mm_unpacklo_epi16(pixel, zero);
+
+      sum = _mm_add_epi32(
+        sum,
+        _mm_madd_epi16(pixel, _mm_set1_epi32((uint16_t)w[k])));
+    }
+
+    sum = _mm_srai_epi32(sum, WEIGHT_BITS);
+    sum = _mm_packs_epi32(sum, sum);
+
+    dest[n] = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+#else
+    int a = round, r = round, g = round, b = round;
+
+    for (int k = 0; k < count; k++)
+    {
+      a += ((s[k] >> 24) & 0xff) * w[k];
+      r += ((s[k] >> 16) & 0xff) * w[k];
+      g += ((s[k] >> 8) & 0xff) * w[k];
+      b += (s[k] & 0xff) * w[k];
+    }
+
+    dest[n] =
+      (clamp_channel(a >> WEIGHT_BITS) << 24) |
+      (clamp_channel(r >> WEIGHT_BITS) << 16) |
+      (clamp_channel(g >> WEIGHT_BITS) << 8) |
+       clamp_channel(b >> WEIGHT_BITS);
+#endif
+  }
+}
+
+void Resampler::filter_column(uint32_t *dest, int n, int length) const
+{
+  const int round = 1 << (WEIGHT_BITS - 1);
+  const uint32_t *source =
+    temp.data() + ((weights_y.start[n] - temp_first) * temp_width);
+  const int16_t *w = weights_y.values.data() + weights_y.offset[n];
+  const int count = weights_y.count[n];
+  int x = 0;
+
+#ifdef __SSE2__
+  // 4 pixels at a time. Interleaving the channels of 2 rows lets madd
+  // apply both of their weights at once.
+  const __m128i zero = _mm_setzero_si128();
+
+  for (; x + 4 <= length; x += 4)
+  {
+    __m128i sum_0 = _mm_set1_epi32(round);
+    __m128i sum_1 = sum_0;
+    __m128i sum_2 = sum_0;
+    __m128i sum_3 = sum_0;
+
+    for (int k = 0; k < count; k += 2)
+    {
+      const uint32_t *row = source + (k * temp_width) + x;
+      __m128i a = _mm_loadu_si128((const __m128i *)row);
+      __m128i b = zero;
+      uint32_t weight = (uint16_t)w[k];
+
+      if (k + 1 < count)
+      {
+        b = _mm_loadu_si128((const __m128i *)(row + temp_width));
+        weight |= (uint32_t)(uint16_t)w[k + 1] << 16;
+      }
+
+      __m128i weights = _mm_set1_epi32(weight);
+      __m128i a_lo = _mm_unpacklo_epi8(a, zero);
+      __m128i a_hi = _mm_unpackhi_epi8(a, zero);
+      __m128i b_lo = _mm_unpacklo_epi8(b, zero);
+      __m128i b_hi = _mm_unpackhi_epi8(b, zero);
+
+      sum_0 = _mm_add_epi32(sum_0, _mm_madd_epi16(_mm_unpacklo_epi16(a_lo, b_lo), weights));
+      sum_1 = _mm_add_epi32(sum_1, _mm_madd_epi16(_mm_unpackhi_epi16(a_lo, b_lo), weights));
+      sum_2 = _mm_add_epi32(sum_2, _mm_madd_epi16(_mm_unpacklo_epi16(a_hi, b_hi), weights));
+      sum_3 = _mm_add_epi32(sum_3, _mm_madd_epi16(_mm_unpackhi_epi16(a_hi, b_hi), weights));
+    }
+
+    __m128i lo = _mm_packs_epi32(
+      _mm_srai_epi32(sum_0, WEIGHT_BITS),
+      _mm_srai_epi32(sum_1, WEIGHT_BITS));
+    __m128i hi = _mm_packs_epi32(
+      _mm_srai_epi32(sum_2, WEIGHT_BITS),
+      _mm_srai_epi32(sum_3, WEIGHT_BITS));
+
+    _mm_storeu_si128((__m128i *)(dest + x), _mm_packus_epi16(lo, hi));
+  }
+#endif
+
+  for (; x < length; x++)
+  {
+    int a = round, r = round, g = round, b = round;
+
+    for (int k = 0; k < count; k++)
+    {
+      const uint32_t color = source[(k * temp_width) + x];
+
+      a += ((color >> 24) & 0xff) * w[k];
+      r += ((color >> 16) & 0xff) * w[k];
+      g += ((color >> 8) & 0xff) * w[k];
+      b += (color & 0xff) * w[k];
+    }
+
+    dest[x] =
+      (clamp_channel(a >> WEIGHT_BITS) << 24) |
+      (clamp_channel(r >> WEIGHT_BITS) << 16) |
+      (clamp_channel(g >> WEIGHT_BITS) << 8) |
+       clamp_channel(b >> WEIGHT_BITS);
+  }
+}
+
+double Resampler::lanczos3(double x)
+{
+  if (x == 0.0) { return 1.0; }
+  if (x <= -3.0 || x >= 3.0) { return 0.0; }
+
+  const double px = M_PI * x;
+
+  return 3.0 * sin(px) * sin(px / 3.0) / (px * px);
+}
+
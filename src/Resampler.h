@@ -0,0 +1,99 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "WorkerPool.h"
+
+// Separable picture scaler. Rows are filtered horizontally into a
+// temporary buffer which is then filtered vertically. The filter weights
+// for each output column and row are worked out once per scale() call
+// and applied in fixed point. Source pixels past the edge of the picture
+// are left out and the remaining weights renormalized.
+class Resampler
+{
+public:
+  Resampler();
+  ~Resampler();
+
+  enum Filter
+  {
+    // Average of the source area under each output pixel when shrinking,
+    // bilinear when enlarging.
+    FILTER_AREA,
+    // Lanczos with 3 lobes, sharper but can ring around hard edges.
+    FILTER_LANCZOS3
+  };
+
+  void set_filter(Filter value) { filter = value; }
+  Filter get_filter() const { return filter; }
+
+  // Scales a source_width x source_height ARGB picture to width x height
+  // and writes columns x0 to x1 and rows y0 to y1 of the result to dest,
+  // (x1 - x0 + 1) pixels per row. Only the source rows needed for that
+  // area are filtered. If worker_pool isn't nullptr, bands of rows are
+  // spread across its threads. Nothing is written if the sizes are 0 or
+  // less or the area isn't inside the result.
+  void scale(
+    uint32_t *dest,
+    const uint32_t *source,
+    int source_width,
+    int source_height,
+    int width,
+    int height,
+    int x0,
+    int y0,
+    int x1,
+    int y1,
+    WorkerPool *worker_pool);
+
+private:
+  static const int WEIGHT_BITS = 14;
+  static const int BAND_ROWS = 16;
+
+  // Output n reads count[n] source pixels starting at start[n]. Its
+  // weights start at values[offset[n]] and add up to 1 << WEIGHT_BITS.
+  struct Weights
+  {
+    std::vector<int> start;
+    std::vector<int> count;
+    std::vector<int> offset;
+    std::vector<int16_t> values;
+  };
+
+  void compute_weights(
+    Weights &weights,
+    int source_size,
+    int size,
+    int first,
+    int last);
+
+  void filter_row(uint32_t *dest, const uint32_t *source, int length) const;
+  void filter_column(uint32_t *dest, int n, int length) const;
+
+  static double lanczos3(double x);
+
+  Filter filter;
+  Weights weights_x;
+  Weights weights_y;
+  std::vector<double> taps;
+  std::vector<uint32_t> temp;
+  int temp_first;
+  int temp_width;
+};
+
+#endif
+
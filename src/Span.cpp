@@ -0,0 +1,578 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Span.h"
+
+void Span::fill(uint32_t *data, int length, uint32_t color)
+{
+  int n = 0;
+
+#ifdef __SSE2__
+  const __m128i c = _mm_set1_epi32(color);
+
+  for (; n + 8 <= length; n += 8)
+  {
+    _mm_storeu_si128((__m128i *)(data + n), c);
+    _mm_storeu_si128((__m128i *)(data + n + 4), c);
+  }
+#endif
+
+  for (; n < length; n++) { data[n] = color; }
+}
+
+void Span::fill(uint8_t *data, int length, uint8_t color)
+{
+  if (length > 0) { memset(data, color, length); }
+}
+
+void Span::fill(int16_t *data, int length, int16_t value)
+{
+  int n = 0;
+
+#ifdef __SSE2__
+  const __m128i v = _mm_set1_epi16(value);
+
+  for (; n + 8 <= length; n += 8)
+  {
+    _mm_storeu_si128((__m128i *)(data + n), v);
+  }
+#endif
+
+  for (; n < length; n++) { data[n] = value; }
+}
+
+#ifdef __SSE2__
+// Streams 16 byte blocks of value from an aligned start. Returns the
+// number of bytes written.
+static int stream_fill(uint8_t *data, int length, __m128i value)
+{
+  int n = 0;
+
+  for (; n + 64 <= length; n += 64)
+  {
+    _mm_stream_si128((__m128i *)(data + n), value);
+    _mm_stream_si128((__m128i *)(data + n + 16), value);
+    _mm_stream_si128((__m128i *)(data + n + 32), value);
+    _mm_stream_si128((__m128i *)(data + n + 48), value);
+  }
+
+  for (; n + 16 <= length; n += 16)
+  {
+    _mm_stream_si128((__m128i *)(data + n), value);
+  }
+
+  _mm_sfence();
+
+  return n;
+}
+#endif
+
+// Anything under this many bytes probably fits in the cache anyway.
+static const int STREAM_MIN = 256 * 1024;
+
+void Span::clear(uint32_t *data, int length, uint32_t color)
+{
+#ifdef __SSE2__
+  if (length * 4 >= STREAM_MIN)
+  {
+    // Pixels are 4 byte aligned, so at most 3 are needed to get to 16.
+    while (((uintptr_t)data & 15) != 0 && length > 0)
+    {
+      *data++ = color;
+      length--;
+    }
+
+    int n = stream_fill((uint8_t *)data, length * 4, _mm_set1_epi32(color)) / 4;
+
+    data += n;
+    length -= n;
+  }
+#endif
+
+  fill(data, length, color);
+}
+
+void Span::clear(uint8_t *data, int length, uint8_t color)
+{
+#ifdef __SSE2__
+  if (length >= STREAM_MIN)
+  {
+    while (((uintptr_t)data & 15) != 0 && length > 0)
+    {
+      *data++ = color;
+      length--;
+    }
+
+    int n = stream_fill(data, length, _mm_set1_epi8(color));
+
+    data += n;
+    length -= n;
+  }
+#endif
+
+  fill(data, length, color);
+}
+
+void Span::clear(int16_t *data, int length, int16_t value)
+{
+#ifdef __SSE2__
+  if (length * 2 >= STREAM_MIN && ((uintptr_t)data & 1) == 0)
+  {
+    while (((uintptr_t)data & 15) != 0 && length > 0)
+    {
+      *data++ = value;
+      length--;
+    }
+
+    int n = stream_fill((uint8_t *)data, length * 2, _mm_set1_epi16(value)) / 2;
+
+    data += n;
+    length -= n;
+  }
+#endif
+
+  fill(data, length, value);
+}
+
+void Span::fill(
+  uint32_t *data,
+  int16_t *z_buffer,
+  int length,
+  uint32_t color,
+  int z)
+{
+  int n = 0;
+
+#ifdef __SSE2__
+  // The vector compare is on 16 bit values, so z has to fit in one.
+  if (z >= INT16_MIN && z <= INT16_MAX)
+  {
+    const __m128i c = _mm_set1_epi32(color);
+    const __m128i depth = _mm_set1_epi16(z);
+
+    for (; n + 8 <= length; n += 8)
+    {
+      __m128i old_z = _mm_loadu_si128((__m128i *)(z_buffer + n));
+      __m128i hidden = _mm_cmplt_epi16(depth, old_z);
+
+      if (_mm_movemask_epi8(hidden) == 0xffff) { continue; }
+
+      __m128i new_z =
+        _mm_or_si128(_mm_and_si128(hidden, old_z),
+                     _mm_andnot_si128(hidden, depth));
+
+      __m128i hidden_lo = _mm_unpacklo_epi16(hidden, hidden);
+      __m128i hidden_hi = _mm_unpackhi_epi16(hidden, hidden);
+      __m128i old_lo = _mm_loadu_si128((__m128i *)(data + n));
+      __m128i old_hi = _mm_loadu_si128((__m128i *)(data + n + 4));
+
+      __m128i new_lo =
+        _mm_or_si128(_mm_and_si128(hidden_lo, old_lo),
+                     _mm_andnot_si128(hidden_lo, c));
+      __m128i new_hi =
+        _mm_or_si128(_mm_and_si128(hidden_hi, old_hi),
+                     _mm_andnot_si128(hidden_hi, c));
+
+      _mm_storeu_si128((__m128i *)(z_buffer + n), new_z);
+      _mm_storeu_si128((__m128i *)(data + n), new_lo);
+      _mm_storeu_si128((__m128i *)(data + n + 4), new_hi);
+    }
+  }
+#endif
+
+  for (; n < length; n++)
+  {
+    if (z < z_buffer[n]) { continue; }
+
+    data[n] = color;
+    z_buffer[n] = z;
+  }
+}
+
+void Span::fill(
+  uint8_t *data,
+  int16_t *z_buffer,
+  int length,
+  uint8_t color,
+  int z)
+{
+  int n = 0;
+
+#ifdef __SSE2__
+  if (z >= INT16_MIN && z <= INT16_MAX)
+  {
+    const __m128i c = _mm_set1_epi8(color);
+    const __m128i depth = _mm_set1_epi16(z);
+
+    for (; n + 8 <= length; n += 8)
+    {
+      __m128i old_z = _mm_loadu_si128((__m128i *)(z_buffer + n));
+      __m128i hidden = _mm_cmplt_epi16(depth, old_z);
+
+      if (_mm_movemask_epi8(hidden) == 0xffff) { continue; }
+
+      __m128i new_z =
+        _mm_or_si128(_mm_and_si128(hidden, old_z),
+                     _mm_andnot_si128(hidden, depth));
+
+      // Narrow the 16 bit mask to 8 bytes.
+      __m128i hidden_8 = _mm_packs_epi16(hidden, hidden);
+      __m128i old_c = _mm_loadl_epi64((__m128i *)(data + n));
+
+      __m128i new_c =
+        _mm_or_si128(_mm_and_si128(hidden_8, old_c),
+                     _mm_andnot_si128(hidden_8, c));
+
+      _mm_storeu_si128((__m128i *)(z_buffer + n), new_z);
+      _mm_storel_epi64((__m128i *)(data + n), new_c);
+    }
+  }
+#endif
+
+  for (; n < length; n++)
+  {
+    if (z < z_buffer[n]) { continue; }
+
+    data[n] = color;
+    z_buffer[n] = z;
+  }
+}
+
+
+#ifdef __SSE2__
+// Span::blend() for 4 pixels. Channels are widened to 16 bits, where
+// 255 * 255 + 128 still fits.
+static __m128i blend_4(__m128i color, __m128i old)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i max = _mm_set1_epi16(255);
+  const __m128i round = _mm_set1_epi16(128);
+
+  __m128i color_lo = _mm_unpacklo_epi8(color, zero);
+  __m128i color_hi = _mm_unpackhi_epi8(color, zero);
+  __m128i old_lo = _mm_unpacklo_epi8(old, zero);
+  __m128i old_hi = _mm_unpackhi_epi8(old, zero);
+
+  // Copy each pixel's alpha to all 4 of its channels.
+  __m128i a_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(color_lo, 0xff), 0xff);
+  __m128i a_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(color_hi, 0xff), 0xff);
+
+  __m128i lo = _mm_add_epi16(
+    _mm_add_epi16(
+      _mm_mullo_epi16(color_lo, a_lo),
+      _mm_mullo_epi16(old_lo, _mm_sub_epi16(max, a_lo))),
+    round);
+  __m128i hi = _mm_add_epi16(
+    _mm_add_epi16(
+      _mm_mullo_epi16(color_hi, a_hi),
+      _mm_mullo_epi16(old_hi, _mm_sub_epi16(max, a_hi))),
+    round);
+
+  lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+  hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+  return _mm_packus_epi16(lo, hi);
+}
+
+// Blends 8 pixels where z passes the depth test and updates z_buffer.
+static void blend_8(
+  uint32_t *data,
+  int16_t *z_buffer,
+  __m128i color_lo,
+  __m128i color_hi,
+  __m128i depth)
+{
+  __m128i old_z = _mm_loadu_si128((__m128i *)z_buffer);
+  __m128i hidden = _mm_cmplt_epi16(depth, old_z);
+
+  if (_mm_movemask_epi8(hidden) == 0xffff) { return; }
+
+  __m128i new_z =
+    _mm_or_si128(_mm_and_si128(hidden, old_z),
+                 _mm_andnot_si128(hidden, depth));
+
+  __m128i hidden_lo = _mm_unpacklo_epi16(hidden, hidden);
+  __m128i hidden_hi = _mm_unpackhi_epi16(hidden, hidden);
+  __m128i old_lo = _mm_loadu_si128((__m128i *)data);
+  __m128i old_hi = _mm_loadu_si128((__m128i *)(data + 4));
+
+  __m128i new_lo =
+    _mm_or_si128(_mm_and_si128(hidden_lo, old_lo),
+                 _mm_andnot_si128(hidden_lo, blend_4(color_lo, old_lo)));
+  __m128i new_hi =
+    _mm_or_si128(_mm_and_si128(hidden_hi, old_hi),
+                 _mm_andnot_si128(hidden_hi, blend_4(color_hi, old_hi)));
+
+  _mm_storeu_si128((__m128i *)z_buffer, new_z);
+  _mm_storeu_si128((__m128i *)data, new_lo);
+  _mm_storeu_si128((__m128i *)(data + 4), new_hi);
+}
+#endif
+
+void Span::blend(uint32_t *data, int length, uint32_t color)
+{
+  int n = 0;
+
+#ifdef __SSE2__
+  const __m128i c = _mm_set1_epi32(color);
+
+  for (; n + 4 <= length; n += 4)
+  {
+    __m128i old = _mm_loadu_si128((__m128i *)(data + n));
+    _mm_storeu_si128((__m128i *)(data + n), blend_4(c, old));
+  }
+#endif
+
+  for (; n < length; n++) { data[n] = blend(color, data[n]); }
+}
+
+void Span::blend(uint32_t *data, const uint32_t *source, int length)
+{
+  int n = 0;
+
+#ifdef __SSE2__
+  const __m128i alpha_mask = _mm_set1_epi32(0xff000000);
+
+  for (; n + 4 <= length; n += 4)
+  {
+    __m128i c = _mm_loadu_si128((const __m128i *)(source + n));
+    __m128i alpha = _mm_and_si128(c, alpha_mask);
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, _mm_setzero_si128())) == 0xffff)
+    {
+      continue;
+    }
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alpha_mask)) == 0xffff)
+    {
+      _mm_storeu_si128((__m128i *)(data + n), c);
+      continue;
+    }
+
+    __m128i old = _mm_loadu_si128((__m128i *)(data + n));
+    _mm_storeu_si128((__m128i *)(data + n), blend_4(c, old));
+  }
+#endif
+
+  for (; n < length; n++) { data[n] = blend(source[n], data[n]); }
+}
+
+void Span::blend(
+  uint32_t *data,
+  int16_t *z_buffer,
+  int length,
+  uint32_t color,
+  int z)
+{
+  int n = 0;
+
+#ifdef __SSE2__
+  if (z >= INT16_MIN && z <= INT16_MAX)
+  {
+    const __m128i c = _mm_set1_epi32(color);
+    const __m128i depth = _mm_set1_epi16(z);
+
+    for (; n + 8 <= length; n += 8)
+    {
+      blend_8(data + n, z_buffer + n, c, c, depth);
+    }
+  }
+#endif
+
+  for (; n < length; n++)
+  {
+    if (z < z_buffer[n]) { continue; }
+
+    data[n] = blend(color, data[n]);
+    z_buffer[n] = z;
+  }
+}
+
+void Span::blend(
+  uint32_t *data,
+  int16_t *z_buffer,
+  const uint32_t *source,
+  int length,
+  int z)
+{
+  int n = 0;
+
+#ifdef __SSE2__
+  if (z >= INT16_MIN && z <= INT16_MAX)
+  {
+    const __m128i depth = _mm_set1_epi16(z);
+
+    for (; n + 8 <= length; n += 8)
+    {
+      blend_8(
+        data + n,
+        z_buffer + n,
+        _mm_loadu_si128((const __m128i *)(source + n)),
+        _mm_loadu_si128((const __m128i *)(source + n + 4)),
+        depth);
+    }
+  }
+#endif
+
+  for (; n < length; n++)
+  {
+    if (z < z_buffer[n]) { continue; }
+
+    data[n] = blend(source[n], data[n]);
+    z_buffer[n] = z;
+  }
+}
+
+void Span::copy(uint32_t *data, const uint32_t *source, int length)
+{
+  if (length > 0) { memcpy(data, source, length * sizeof(uint32_t)); }
+}
+
+void Span::copy(uint8_t *data, const uint32_t *source, int length)
+{
+  int n = 0;
+
+#ifdef __SSE2__
+  const __m128i mask = _mm_set1_epi32(0xff);
+
+  for (; n + 16 <= length; n += 16)
+  {
+    __m128i c0 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(source + n)), mask);
+    __m128i c1 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(source + n + 4)), mask);
+    __m128i c2 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(source + n + 8)), mask);
+    __m128i c3 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(source + n + 12)), mask);
+
+    __m128i c =
+      _mm_packus_epi16(_mm_packs_epi32(c0, c1), _mm_packs_epi32(c2, c3));
+
+    _mm_storeu_si128((__m128i *)(data + n), c);
+  }
+#endif
+
+  for (; n < length; n++) { data[n] = source[n]; }
+}
+
+void Span::copy(
+  uint32_t *data,
+  int16_t *z_buffer,
+  const uint32_t *source,
+  int length,
+  int z)
+{
+  int n = 0;
+
+#ifdef __SSE2__
+  if (z >= INT16_MIN && z <= INT16_MAX)
+  {
+    const __m128i depth = _mm_set1_epi16(z);
+
+    for (; n + 8 <= length; n += 8)
+    {
+      __m128i old_z = _mm_loadu_si128((__m128i *)(z_buffer + n));
+      __m128i hidden = _mm_cmplt_epi16(depth, old_z);
+
+      if (_mm_movemask_epi8(hidden) == 0xffff) { continue; }
+
+      __m128i new_z =
+        _mm_or_si128(_mm_and_si128(hidden, old_z),
+                     _mm_andnot_si128(hidden, depth));
+
+      __m128i hidden_lo = _mm_unpacklo_epi16(hidden, hidden);
+      __m128i hidden_hi = _mm_unpackhi_epi16(hidden, hidden);
+      __m128i old_lo = _mm_loadu_si128((__m128i *)(data + n));
+      __m128i old_hi = _mm_loadu_si128((__m128i *)(data + n + 4));
+      __m128i c_lo = _mm_loadu_si128((const __m128i *)(source + n));
+      __m128i c_hi = _mm_loadu_si128((const __m128i *)(source + n + 4));
+
+      __m128i new_lo =
+        _mm_or_si128(_mm_and_si128(hidden_lo, old_lo),
+                     _mm_andnot_si128(hidden_lo, c_lo));
+      __m128i new_hi =
+        _mm_or_si128(_mm_and_si128(hidden_hi, old_hi),
+                     _mm_andnot_si128(hidden_hi, c_hi));
+
+      _mm_storeu_si128((__m128i *)(z_buffer + n), new_z);
+      _mm_storeu_si128((__m128i *)(data + n), new_lo);
+      _mm_storeu_si128((__m128i *)(data + n + 4), new_hi);
+    }
+  }
+#endif
+
+  for (; n < length; n++)
+  {
+    if (z < z_buffer[n]) { continue; }
+
+    data[n] = source[n];
+    z_buffer[n] = z;
+  }
+}
+
+void Span::copy(
+  uint8_t *data,
+  int16_t *z_buffer,
+  const uint32_t *source,
+  int length,
+  int z)
+{
+  int n = 0;
+
+#ifdef __SSE2__
+  if (z >= INT16_MIN && z <= INT16_MAX)
+  {
+    const __m128i depth = _mm_set1_epi16(z);
+    const __m128i mask = _mm_set1_epi32(0xff);
+
+    for (; n + 8 <= length; n += 8)
+    {
+      __m128i old_z = _mm_loadu_si128((__m128i *)(z_buffer + n));
+      __m128i hidden = _mm_cmplt_epi16(depth, old_z);
+
+      if (_mm_movemask_epi8(hidden) == 0xffff) { continue; }
+
+      __m128i new_z =
+        _mm_or_si128(_mm_and_si128(hidden, old_z),
+                     _mm_andnot_si128(hidden, depth));
+
+      __m128i c0 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(source + n)), mask);
+      __m128i c1 = _mm_and_si128(_mm_loadu_si128((const __m128i *)(source + n + 4)), mask);
+      __m128i c = _mm_packs_epi32(c0, c1);
+      c = _mm_packus_epi16(c, c);
+
+      __m128i hidden_8 = _mm_packs_epi16(hidden, hidden);
+      __m128i old_c = _mm_loadl_epi64((__m128i *)(data + n));
+
+      __m128i new_c =
+        _mm_or_si128(_mm_and_si128(hidden_8, old_c),
+                     _mm_andnot_si128(hidden_8, c));
+
+      _mm_storeu_si128((__m128i *)(z_buffer + n), new_z);
+      _mm_storel_epi64((__m128i *)(data + n), new_c);
+    }
+  }
+#endif
+
+  for (; n < length; n++)
+  {
+    if (z < z_buffer[n]) { continue; }
+
+    data[n] = source[n];
+    z_buffer[n] = z;
+  }
+}
+
@@ -0,0 +1,110 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#ifndef SPAN_H
+#define SPAN_H
+
+#include <stdint.h>
+
+// Kernels that work on a whole run of pixels in a row. Callers clip the
+// span first, so none of these do any bounds checking.
+class Span
+{
+public:
+  static void fill(uint32_t *data, int length, uint32_t color);
+  static void fill(uint8_t *data, int length, uint8_t color);
+
+  static void fill(int16_t *data, int length, int16_t value);
+
+  // Same as fill() but buffers too big to stay in the cache are written
+  // with non-temporal stores, so clearing a whole frame doesn't push
+  // everything else out of the cache.
+  static void clear(uint32_t *data, int length, uint32_t color);
+  static void clear(uint8_t *data, int length, uint8_t color);
+  static void clear(int16_t *data, int length, int16_t value);
+
+  // A pixel is written (and z_buffer updated) unless z < z_buffer.
+  static void fill(
+    uint32_t *data,
+    int16_t *z_buffer,
+    int length,
+    uint32_t color,
+    int z);
+
+  static void fill(
+    uint8_t *data,
+    int16_t *z_buffer,
+    int length,
+    uint8_t color,
+    int z);
+
+  // Copies a row of source pixels. An 8 bit picture gets the low byte,
+  // which is the palette index.
+  static void copy(uint32_t *data, const uint32_t *source, int length);
+  static void copy(uint8_t *data, const uint32_t *source, int length);
+
+  static void copy(
+    uint32_t *data,
+    int16_t *z_buffer,
+    const uint32_t *source,
+    int length,
+    int z);
+
+  static void copy(
+    uint8_t *data,
+    int16_t *z_buffer,
+    const uint32_t *source,
+    int length,
+    int z);
+
+  // Blends color over old using the alpha in the top byte of color. Each
+  // of the 4 channels is (color * a + old * (255 - a)) / 255 rounded to
+  // nearest, so an alpha of 0 or 255 gives exactly old or color.
+  static uint32_t blend(uint32_t color, uint32_t old)
+  {
+    uint32_t a = color >> 24;
+    uint32_t rb =
+      ((color & 0xff00ff) * a) + ((old & 0xff00ff) * (255 - a)) + 0x800080;
+    uint32_t ag =
+      (((color >> 8) & 0xff00ff) * a) +
+      (((old >> 8) & 0xff00ff) * (255 - a)) + 0x800080;
+
+    // Both channels in each are divided by 255 at once as (x + (x >> 8)) >> 8.
+    rb = ((rb + ((rb >> 8) & 0xff00ff)) >> 8) & 0xff00ff;
+    ag = (ag + ((ag >> 8) & 0xff00ff)) & 0xff00ff00;
+
+    return ag | rb;
+  }
+
+  // Same as blend() for a whole span, either one color or a row of source
+  // pixels that each have their own alpha. Runs of source pixels with an
+  // alpha of 0 (color keyed) or 255 are skipped or copied.
+  static void blend(uint32_t *data, int length, uint32_t color);
+  static void blend(uint32_t *data, const uint32_t *source, int length);
+
+  // Same as above but pixels where z < z_buffer are left alone.
+  static void blend(
+    uint32_t *data,
+    int16_t *z_buffer,
+    int length,
+    uint32_t color,
+    int z);
+
+  static void blend(
+    uint32_t *data,
+    int16_t *z_buffer,
+    const uint32_t *source,
+    int length,
+    int z);
+};
+
+#endif
+
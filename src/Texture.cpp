@@ -15,9 +15,12 @@
 #include "Texture.h"
 
 Texture::Texture() :
-  scale_angle { 0.0 },
-  center_x    {   0 },
-  center_y    {   0 }
+  scale_angle  { 0.0 },
+  center_x     {   0 },
+  center_y     {   0 },
+  width        {   0 },
+  height       {   0 },
+  tile_columns {   0 }
 {
 }
 
@@ -27,7 +30,11 @@ Texture::~Texture()
 
 int Texture::load(const char *filename)
 {
-  return picture.load(filename);
+  int result = picture.load(filename);
+
+  build_tiles();
+
+  return result;
 }
 
 void Texture::set_image_angle(int x0, int y0, int x1, int y1, int x2, int y2)
@@ -91,8 +98,30 @@ void Texture::set_coords(
 
   angle.set_center(center_x, center_y);
   angle.set_from_xy(area.x0, area.y0, area.x2, area.y2);
+}
+
+void Texture::build_tiles()
+{
+  width  = picture.get_width();
+  height = picture.get_height();
+
+  if (picture.get_data() == nullptr) { width = 0; height = 0; }
+
+  // Partial tiles on the right and bottom are padded out to full tiles.
+  tile_columns = (width + TILE_MASK) >> TILE_BITS;
+  int tile_rows = (height + TILE_MASK) >> TILE_BITS;
+
+  texels.assign(tile_columns * tile_rows * TILE_SIZE * TILE_SIZE, 0);
+
+  const uint32_t *data = picture.get_data();
 
-  dump();
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      texels[get_tiled_index(x, y)] = data[(y * width) + x];
+    }
+  }
 }
 
 void Texture::dump()
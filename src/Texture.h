@@ -15,6 +15,8 @@
 #include <stdint.h>
 #include <math.h>
 
+#include <vector>
+
 #include "Angle.h"
 #include "Picture.h"
 #include "PolarCoords.h"
@@ -34,6 +36,29 @@ public:
   uint32_t get_pixel(double angle, int r);
   uint32_t get_pixel(int x, int y);
 
+  int get_width()  const { return width; }
+  int get_height() const { return height; }
+
+  // Texel at u, v in 16.16 fixed point texel units. Coordinates outside
+  // the picture are clamped to the edge.
+  uint32_t get_texel(int32_t u, int32_t v) const
+  {
+    if (width == 0) { return 0; }
+
+    int x = u >> 16;
+    int y = v >> 16;
+
+    if (x < 0) { x = 0; }
+      else
+    if (x >= width) { x = width - 1; }
+
+    if (y < 0) { y = 0; }
+      else
+    if (y >= height) { y = height - 1; }
+
+    return texels[get_tiled_index(x, y)];
+  }
+
   //void compute_scale(double angle, int length_a, int length_b);
 
   void set_coords(
@@ -58,6 +83,8 @@ public:
     double u2, v2;
   };
 
+  const AreaUV &get_coords() const { return coords_uv; }
+
   // New code.
   struct AreaXY
   {
@@ -104,6 +131,25 @@ public:
   void dump();
 
 private:
+  // Texels are kept in TILE_SIZE x TILE_SIZE tiles (1k each) so texels
+  // that are close in any direction are usually close in memory too.
+  // Rotated triangles then don't walk the texture a row apart per texel.
+  static const int TILE_BITS = 4;
+  static const int TILE_SIZE = 1 << TILE_BITS;
+  static const int TILE_MASK = TILE_SIZE - 1;
+
+  int get_tiled_index(int x, int y) const
+  {
+    int tile = ((y >> TILE_BITS) * tile_columns) + (x >> TILE_BITS);
+
+    return
+      (tile << (TILE_BITS * 2)) +
+      ((y & TILE_MASK) << TILE_BITS) +
+      (x & TILE_MASK);
+  }
+
+  void build_tiles();
+
   // New code.
   int convert_uv_to_xy(int &x, int &y, double u, double v)
   {
@@ -137,6 +183,9 @@ private:
   int center_y;
 
   Picture picture;
+  std::vector<uint32_t> texels;
+  int width, height;
+  int tile_columns;
 };
 
 #endif
@@ -0,0 +1,180 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "Transform.h"
+
+void Transform::set_identity()
+{
+  for (int r = 0; r < 4; r++)
+  {
+    for (int c = 0; c < 4; c++)
+    {
+      m[r][c] = r == c ? 1.0 : 0.0;
+    }
+  }
+}
+
+void Transform::set_matrix(const double values[16])
+{
+  for (int n = 0; n < 16; n++) { m[n / 4][n % 4] = values[n]; }
+}
+
+void Transform::set_matrix_3x3(const double values[9])
+{
+  set_identity();
+
+  for (int n = 0; n < 9; n++) { m[n / 3][n % 3] = values[n]; }
+}
+
+void Transform::rotate_x(double r)
+{
+  double c = cos(r);
+  double s = sin(r);
+
+  // [     1       0         0   ]
+  // [     0   cos(rx)  -sin(rx) ]
+  // [     0   sin(rx)   cos(rx) ]
+  const double values[9] =
+  {
+    1, 0,  0,
+    0, c, -s,
+    0, s,  c
+  };
+
+  Transform transform;
+  transform.set_matrix_3x3(values);
+
+  multiply(transform);
+}
+
+void Transform::rotate_y(double r)
+{
+  double c = cos(r);
+  double s = sin(r);
+
+  // [ cos(ry)     0     sin(ry) ]
+  // [      0      1         0   ]
+  // [ -sin(ry)    0     cos(ry) ]
+  const double values[9] =
+  {
+     c, 0, s,
+     0, 1, 0,
+    -s, 0, c
+  };
+
+  Transform transform;
+  transform.set_matrix_3x3(values);
+
+  multiply(transform);
+}
+
+void Transform::rotate_z(double r)
+{
+  double c = cos(r);
+  double s = sin(r);
+
+  // [ cos(rz) -sin(rz)      0   ]
+  // [ sin(rz)  cos(rz)      0   ]
+  // [     0       0         1   ]
+  const double values[9] =
+  {
+    c, -s, 0,
+    s,  c, 0,
+    0,  0, 1
+  };
+
+  Transform transform;
+  transform.set_matrix_3x3(values);
+
+  multiply(transform);
+}
+
+void Transform::translate(double x, double y, double z)
+{
+  Transform transform;
+
+  transform.m[0][3] = x;
+  transform.m[1][3] = y;
+  transform.m[2][3] = z;
+
+  multiply(transform);
+}
+
+void Transform::project(double scale)
+{
+  Transform transform;
+
+  transform.m[3][2] = 1.0 / scale;
+
+  multiply(transform);
+}
+
+void Transform::multiply(const Transform &transform)
+{
+  double result[4][4];
+
+  // The new transform goes on the left so it's applied last.
+  for (int r = 0; r < 4; r++)
+  {
+    for (int c = 0; c < 4; c++)
+    {
+      result[r][c] =
+        (transform.m[r][0] * m[0][c]) +
+        (transform.m[r][1] * m[1][c]) +
+        (transform.m[r][2] * m[2][c]) +
+        (transform.m[r][3] * m[3][c]);
+    }
+  }
+
+  for (int r = 0; r < 4; r++)
+  {
+    for (int c = 0; c < 4; c++)
+    {
+      m[r][c] = result[r][c];
+    }
+  }
+}
+
+void Transform::apply(int &x, int &y, int &z, double &w) const
+{
+  double tx = x;
+  double ty = y;
+  double tz = z;
+
+  apply(tx, ty, tz, w);
+
+  x = tx;
+  y = ty;
+  z = tz;
+}
+
+void Transform::apply(double &x, double &y, double &z, double &w) const
+{
+  double tx = (m[0][0] * x) + (m[0][1] * y) + (m[0][2] * z) + m[0][3];
+  double ty = (m[1][0] * x) + (m[1][1] * y) + (m[1][2] * z) + m[1][3];
+  double tz = (m[2][0] * x) + (m[2][1] * y) + (m[2][2] * z) + m[2][3];
+  w = (m[3][0] * x) + (m[3][1] * y) + (m[3][2] * z) + m[3][3];
+
+  if (w != 1.0)
+  {
+    tx = tx / w;
+    ty = ty / w;
+  }
+
+  x = tx;
+  y = ty;
+  z = tz;
+}
+
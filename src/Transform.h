@@ -0,0 +1,69 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <stdint.h>
+
+// 4x4 matrix that rotates, translates and projects a vertex in one step.
+// It's built once per draw so the trig is only done once, and vertexes
+// are only rounded to int after the whole transform.
+class Transform
+{
+public:
+  Transform() { set_identity(); }
+  ~Transform() { }
+
+  void set_identity();
+
+  // Values are row major. A 3x3 matrix leaves translation at 0.
+  void set_matrix(const double values[16]);
+  void set_matrix_3x3(const double values[9]);
+
+  // Each of these is applied after what is already in the transform.
+  void rotate_x(double r);
+  void rotate_y(double r);
+  void rotate_z(double r);
+  void translate(double x, double y, double z);
+  void multiply(const Transform &transform);
+
+  // Weak perspective projection with w = 1 + (z / scale). Only x and y
+  // are divided by w, z is kept as is for the z buffer.
+  void project(double scale);
+
+  // Rotates around x, then y, then z.
+  void set_rotation(double rx, double ry, double rz)
+  {
+    set_identity();
+    rotate_x(rx);
+    rotate_y(ry);
+    rotate_z(rz);
+  }
+
+  void apply(int &x, int &y, int &z) const
+  {
+    double w;
+    apply(x, y, z, w);
+  }
+
+  // Also returns w, which is needed to interpolate perspective correctly.
+  void apply(int &x, int &y, int &z, double &w) const;
+
+  // Same, but nothing is rounded so x and y keep their sub-pixel part.
+  void apply(double &x, double &y, double &z, double &w) const;
+
+private:
+  double m[4][4];
+};
+
+#endif
+
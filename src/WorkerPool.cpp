@@ -0,0 +1,114 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(int thread_count) :
+  job          { nullptr },
+  next_index   { 0 },
+  job_count    { 0 },
+  busy_count   { 0 },
+  generation   { 0 },
+  thread_count { thread_count },
+  is_running   { true }
+{
+  if (this->thread_count < 1) { this->thread_count = 1; }
+
+  for (int n = 1; n < this->thread_count; n++)
+  {
+    threads.push_back(std::thread(&WorkerPool::worker_main, this));
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    is_running = false;
+  }
+
+  start_condition.notify_all();
+
+  for (auto &thread : threads) { thread.join(); }
+}
+
+void WorkerPool::run(int count, const std::function<void(int)> &function)
+{
+  if (count <= 0) { return; }
+
+  if (threads.size() == 0 || count == 1)
+  {
+    for (int n = 0; n < count; n++) { function(n); }
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    job = &function;
+    job_count = count;
+    next_index = 0;
+    busy_count = threads.size();
+    generation++;
+  }
+
+  start_condition.notify_all();
+
+  do_work();
+
+  std::unique_lock<std::mutex> lock(mutex);
+  done_condition.wait(lock, [this] { return busy_count == 0; });
+
+  job = nullptr;
+}
+
+void WorkerPool::worker_main()
+{
+  int last_generation = 0;
+
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      start_condition.wait(lock, [this, last_generation]
+      {
+        return !is_running || generation != last_generation;
+      });
+
+      if (!is_running) { return; }
+
+      last_generation = generation;
+    }
+
+    do_work();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    busy_count--;
+
+    if (busy_count == 0) { done_condition.notify_one(); }
+  }
+}
+
+void WorkerPool::do_work()
+{
+  while (true)
+  {
+    int index = next_index++;
+    if (index >= job_count) { break; }
+
+    (*job)(index);
+  }
+}
+
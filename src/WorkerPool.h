@@ -0,0 +1,57 @@
+/*
+
+  Kohn3D - GIF drawing library.
+
+  Copyright 2026 - Michael Kohn (mike@mikekohn.net)
+  https://www.mikekohn.net/
+
+  This code falls under the LGPL license.
+
+*/
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool
+{
+public:
+  // The calling thread also does work, so thread_count - 1 threads
+  // are started.
+  WorkerPool(int thread_count);
+  virtual ~WorkerPool();
+
+  int get_thread_count() { return thread_count; }
+
+  // Calls function(index) for index 0 to count - 1 spread across all
+  // threads and returns after every call has finished.
+  void run(int count, const std::function<void(int)> &function);
+
+private:
+  void worker_main();
+  void do_work();
+
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable start_condition;
+  std::condition_variable done_condition;
+
+  const std::function<void(int)> *job;
+  std::atomic<int> next_index;
+  int job_count;
+  int busy_count;
+  int generation;
+  int thread_count;
+  bool is_running;
+};
+
+#endif
+
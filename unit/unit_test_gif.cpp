@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "ImageWriterGif.h"
+
+#define TEST_INT(a, b) \
+  if (a != b) \
+  { \
+    printf("Error %d != %d  -- %s:%d\n", a, b, __FILE__, __LINE__); \
+    errors += 1; \
+  }
+
+static const char *filename = "unit_test_gif.gif";
+
+// Decodes the LZW data of one image from data, which is the code size
+// byte followed by the data sub-blocks. Every code has to be read at the
+// width the encoder should have written it, so a stream that only
+// happens to give the right pixels still fails at the EOF code. Returns
+// -1 on a bad stream.
+static int decode_image(
+  const uint8_t *data,
+  int length,
+  std::vector<uint8_t> &pixels)
+{
+  const int min_code_size = data[0];
+  const int clear_code = 1 << min_code_size;
+  const int eof_code = clear_code + 1;
+
+  std::vector<uint8_t> codes;
+  int ptr = 1;
+
+  while (ptr < length && data[ptr] != 0)
+  {
+    codes.insert(codes.end(), data + ptr + 1, data + ptr + 1 + data[ptr]);
+    ptr += data[ptr] + 1;
+  }
+
+  int prefixes[4096];
+  uint8_t suffixes[4096];
+  uint8_t firsts[4096];
+  uint8_t temp[4096];
+
+  for (int n = 0; n < clear_code; n++)
+  {
+    prefixes[n] = -1;
+    suffixes[n] = n;
+    firsts[n] = n;
+  }
+
+  int code_size = min_code_size + 1;
+  int next_code = eof_code + 1;
+  int last_code = -1;
+  int bit = 0;
+
+  while (true)
+  {
+    if (bit + code_size > (int)codes.size() * 8) { return -1; }
+
+    int code = 0;
+
+    for (int n = 0; n < code_size; n++, bit++)
+    {
+      code |= ((codes[bit >> 3] >> (bit & 7)) & 1) << n;
+    }
+
+    if (code == eof_code) { return 0; }
+
+    if (code == clear_code)
+    {
+      code_size = min_code_size + 1;
+      next_code = eof_code + 1;
+      last_code = -1;
+      continue;
+    }
+
+    if (code > next_code || (last_code == -1 && code >= clear_code))
+    {
+      return -1;
+    }
+
+    if (last_code != -1 && next_code < 4096)
+    {
+      const int first = code == next_code ? firsts[last_code] : firsts[code];
+
+      prefixes[next_code] = last_code;
+      suffixes[next_code] = first;
+      firsts[next_code] = firsts[last_code];
+      next_code++;
+
+      if (next_code == (1 << code_size) && code_size < 12) { code_size++; }
+    }
+
+    int count = 0;
+
+    for (int n = code; n != -1; n = prefixes[n]) { temp[count++] = suffixes[n]; }
+
+    while (count > 0) { pixels.push_back(temp[--count]); }
+
+    last_code = code;
+  }
+}
+
+// Returns the pixels of the first image in the file, which the encoder
+// writes without any local color table.
+static int read_gif(std::vector<uint8_t> &pixels)
+{
+  FILE *in = fopen(filename, "rb");
+  if (in == nullptr) { return -1; }
+
+  std::vector<uint8_t> data(1 << 20);
+  const int length = fread(data.data(), 1, data.size(), in);
+  fclose(in);
+
+  int ptr = 13 + (3 << ((data[10] & 7) + 1));
+
+  while (ptr < length)
+  {
+    if (data[ptr] == ',')
+    {
+      return decode_image(data.data() + ptr + 10, length - (ptr + 10), pixels);
+    }
+
+    if (data[ptr] != 0x21) { return -1; }
+
+    // Extension blocks are the label and then sub-blocks.
+    ptr += 2;
+
+    while (ptr < length && data[ptr] != 0) { ptr += data[ptr] + 1; }
+
+    ptr++;
+  }
+
+  return -1;
+}
+
+int test_strips(int width, int height, int colors, int strips, int threads)
+{
+  int errors = 0;
+
+  std::vector<uint8_t> image(width * height);
+  uint32_t palette[256];
+
+  for (int n = 0; n < colors; n++) { palette[n] = n * 0x010101; }
+
+  // Short runs of each color so the table fills and codes grow inside
+  // the strips.
+  for (int n = 0; n < width * height; n++) { image[n] = (n / 7) % colors; }
+
+  // The file is finished and closed when the writer goes out of scope.
+  {
+    ImageWriterGif image_writer(width, height);
+    image_writer.create(filename);
+    image_writer.set_encode_strips(strips);
+    image_writer.set_encode_threads(threads);
+    image_writer.set_palette(palette, colors);
+    image_writer.create_headers();
+    image_writer.add_frame(image.data(), palette);
+  }
+
+  std::vector<uint8_t> pixels;
+
+  const int result = read_gif(pixels);
+
+  TEST_INT(result, 0);
+  TEST_INT((int)pixels.size(), width * height);
+
+  if (pixels != image)
+  {
+    printf("Error pixels don't match (strips=%d)  -- %s:%d\n",
+      strips, __FILE__, __LINE__);
+    errors += 1;
+  }
+
+  return errors;
+}
+
+int main(int argc, char *argv[])
+{
+  int errors = 0;
+
+  const int strips[] = { 1, 2, 3, 7, 16, 40, 61 };
+
+  for (int count : strips)
+  {
+    errors += test_strips(83, 61, 16, count, 1);
+    errors += test_strips(83, 61, 16, count, 4);
+    errors += test_strips(320, 240, 256, count, 1);
+    errors += test_strips(97, 89, 4, count, 1);
+  }
+
+  remove(filename);
+
+  printf("Errors: %d  (%s)\n", errors, errors == 0 ? "PASS" : "FAIL");
+
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Picture.h"
+
+#define TEST_HEX(a, b) \
+  if (a != b) \
+  { \
+    printf("Error 0x%08x != 0x%08x  -- %s:%d\n", a, b, __FILE__, __LINE__); \
+    errors += 1; \
+  }
+
+// Boxes with more than 2^31 in a channel's sum. 4000 x 3000 needs it
+// for the bright channels, 4200 x 4100 is also too big to sum in one go.
+int test_large_area_average(int width, int height)
+{
+  int errors = 0;
+
+  Picture picture;
+  picture.create(width, height);
+  picture.enable_summed_area_table(true);
+
+  uint32_t *data = picture.get_data();
+
+  for (int n = 0; n < width * height; n++) { data[n] = 0xffc08040; }
+
+  picture.mark_modified();
+
+  uint32_t color = picture.get_area_average(0, 0, width, height);
+  TEST_HEX(color, 0xffc08040);
+
+  color = picture.get_area_average(0.5, 0.25, width - 0.3, height - 0.7);
+  TEST_HEX(color, 0xffc08040);
+
+  // Left half white, right half black.
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      data[(y * width) + x] = x < width / 2 ? 0xffffffff : 0x00000000;
+    }
+  }
+
+  picture.mark_modified();
+
+  color = picture.get_area_average(0, 0, width, height);
+  TEST_HEX(color, 0x80808080);
+
+  color = picture.get_area_average(0, 0, width / 2, height);
+  TEST_HEX(color, 0xffffffff);
+
+  return errors;
+}
+
+int main(int argc, char *argv[])
+{
+  int errors = 0;
+
+  errors += test_large_area_average(4000, 3000);
+  errors += test_large_area_average(4200, 4100);
+
+  printf("Errors: %d  (%s)\n", errors, errors == 0 ? "PASS" : "FAIL");
+
+  return 0;
+}
+
@@ -2,6 +2,9 @@
 #include <stdlib.h>
 #include <math.h>
 
+#include <vector>
+
+#include "FastMath.h"
 #include "PolarCoords.h"
 
 #define TEST_INT(a, b) \
@@ -62,6 +65,113 @@ int test_polar_coords(int x0, int y0)
   return errors;
 }
 
+int test_fast_polar_coords(int x0, int y0)
+{
+  int errors = 0;
+
+  double p;
+  int r;
+
+  PolarCoords::from_xy_fast(p, r, x0, y0);
+
+  int x = 0, y = 0;
+  PolarCoords::to_xy_fast(x, y, p, r);
+
+  TEST_INT(x, x0);
+  TEST_INT(y, y0);
+
+  return errors;
+}
+
+int test_fast_math()
+{
+  int errors = 0;
+  double error_sin = 0;
+  double error_cos = 0;
+  double error_atan2 = 0;
+
+  for (double p = -20.0; p < 20.0; p += 0.001)
+  {
+    error_sin = fmax(error_sin, fabs(FastMath::sin(p) - sin(p)));
+    error_cos = fmax(error_cos, fabs(FastMath::cos(p) - cos(p)));
+  }
+
+  for (int y = -300; y <= 300; y += 3)
+  {
+    for (int x = -300; x <= 300; x += 3)
+    {
+      error_atan2 = fmax(error_atan2, fabs(FastMath::atan2(y, x) - atan2(y, x)));
+    }
+  }
+
+  if (error_sin > 1e-10 || error_cos > 1e-10 || error_atan2 > 1e-10)
+  {
+    printf("Error FastMath sin=%g cos=%g atan2=%g  -- %s:%d\n",
+      error_sin, error_cos, error_atan2, __FILE__, __LINE__);
+    errors += 1;
+  }
+
+  return errors;
+}
+
+// The batch functions do 2 at a time and the rest one at a time, so odd
+// counts cover both paths. They should match the scalar ones exactly.
+int test_fast_math_batch(int count)
+{
+  int errors = 0;
+  std::vector<int> x(count), y(count), r(count);
+  std::vector<double> p(count);
+  std::vector<int> x_out(count), y_out(count);
+
+  srand(count);
+
+  for (int n = 0; n < count; n++)
+  {
+    x[n] = (rand() % 20001) - 10000;
+    y[n] = (rand() % 20001) - 10000;
+  }
+
+  // Include the axes and the origin.
+  if (count >= 4)
+  {
+    x[0] = 0; y[0] = 0;
+    x[1] = 0; y[1] = -37;
+    x[2] = -37; y[2] = 0;
+    x[3] = 25; y[3] = 25;
+  }
+
+  FastMath::from_xy(p.data(), r.data(), x.data(), y.data(), count);
+
+  for (int n = 0; n < count; n++)
+  {
+    double p0;
+    int r0;
+
+    PolarCoords::from_xy_fast(p0, r0, x[n], y[n]);
+
+    if (p[n] != p0 || r[n] != r0)
+    {
+      printf("Error FastMath::from_xy(%d, %d) %.17g %d != %.17g %d  -- %s:%d\n",
+        x[n], y[n], p[n], r[n], p0, r0, __FILE__, __LINE__);
+      errors += 1;
+    }
+  }
+
+  FastMath::to_xy(x_out.data(), y_out.data(), p.data(), r.data(), count);
+
+  for (int n = 0; n < count; n++)
+  {
+    int x0, y0;
+
+    PolarCoords::to_xy_fast(x0, y0, p[n], r[n]);
+
+    TEST_INT(x_out[n], x0);
+    TEST_INT(y_out[n], y0);
+  }
+
+  return errors;
+}
+
 int test_centered(int x0, int y0, double degrees, int r)
 {
   int errors = 0;
@@ -137,6 +247,16 @@ int main(int argc, char *argv[])
   errors += test_polar_coords( 96,  45);
   errors += test_polar_coords(-96,  45);
 
+  errors += test_fast_polar_coords(-99,  99);
+  errors += test_fast_polar_coords( 99, -99);
+  errors += test_fast_polar_coords( 99,  99);
+  errors += test_fast_polar_coords( 96,  45);
+  errors += test_fast_polar_coords(-96,  45);
+  errors += test_fast_math();
+  errors += test_fast_math_batch(1);
+  errors += test_fast_math_batch(1000);
+  errors += test_fast_math_batch(1001);
+
   errors += test_centered(200, 400, 180, 200);
   errors += test_centered(400, 200,  90, 200);
   errors += test_centered(400, 600, 270, 200);
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "Kohn3D.h"
+
+#define TEST_INT(a, b) \
+  if (a != b) \
+  { \
+    printf("Error %d != %d  -- %s:%d\n", a, b, __FILE__, __LINE__); \
+    errors += 1; \
+  }
+
+static const int WIDTH = 640;
+static const int HEIGHT = 480;
+
+// Draws the triangle centered on the picture and then a rect covering
+// the whole picture 2 units behind the triangle's farthest vertex. None
+// of the triangle's pixels should be covered by the rect. Returns how
+// many were.
+static int count_covered(Kohn3D &kohn3d, const Kohn3D::Triangle &triangle)
+{
+  int z_min = triangle.z0;
+
+  if (triangle.z1 < z_min) { z_min = triangle.z1; }
+  if (triangle.z2 < z_min) { z_min = triangle.z2; }
+
+  kohn3d.clear();
+  kohn3d.draw_triangle(triangle, WIDTH / 2, HEIGHT / 2, 0, 1);
+
+  uint8_t *picture = kohn3d.get_picture();
+  std::vector<int> pixels;
+
+  for (int n = 0; n < WIDTH * HEIGHT; n++)
+  {
+    if (picture[n] == 1) { pixels.push_back(n); }
+  }
+
+  kohn3d.draw_rect(0, 0, WIDTH - 1, HEIGHT - 1, 2, z_min - 2);
+
+  picture = kohn3d.get_picture();
+
+  int count = 0;
+
+  for (int n : pixels)
+  {
+    if (picture[n] != 1) { count++; }
+  }
+
+  return count;
+}
+
+int test_thin_triangle_depth(int threads)
+{
+  int errors = 0;
+
+  Kohn3D kohn3d(WIDTH, HEIGHT, Kohn3D::FORMAT_BMP8);
+  kohn3d.create("/dev/null");
+  kohn3d.init_end();
+  kohn3d.set_render_threads(threads);
+
+  // The depth plane is far out of range at the left edge of this
+  // triangle's bounding box.
+  Kohn3D::Triangle triangle;
+  triangle.set_vertex_0(405, 317, -64);
+  triangle.set_vertex_1(26, -238, -784);
+  triangle.set_vertex_2(-55, -275, -547);
+
+  int count = count_covered(kohn3d, triangle);
+
+  TEST_INT(count, 0);
+
+  srand(1);
+
+  for (int n = 0; n < 1000; n++)
+  {
+    triangle.set_vertex_0(rand() % 800 - 400, rand() % 600 - 300, -(rand() % 1000));
+    triangle.set_vertex_1(rand() % 800 - 400, rand() % 600 - 300, -(rand() % 1000));
+    triangle.set_vertex_2(rand() % 800 - 400, rand() % 600 - 300, -(rand() % 1000));
+
+    count = count_covered(kohn3d, triangle);
+
+    TEST_INT(count, 0);
+  }
+
+  return errors;
+}
+
+int main(int argc, char *argv[])
+{
+  int errors = 0;
+
+  errors += test_thin_triangle_depth(1);
+  errors += test_thin_triangle_depth(4);
+
+  printf("Errors: %d  (%s)\n", errors, errors == 0 ? "PASS" : "FAIL");
+
+  return 0;
+}
+